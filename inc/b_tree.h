@@ -7,9 +7,60 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include "slab.h"
 #include "utility.h"
+#include "value_log.h"
+
+// 并入的有序元素不少于B树现有元素的1/B_TREE_MERGE_REBUILD时, b_tree_merge改为归并后整体重建
+#define B_TREE_MERGE_REBUILD 8
+// 并入的元素少于B_TREE_MERGE_MIN个时总是逐个插入, 重建的固定开销不值得
+#define B_TREE_MERGE_MIN 64
+// B树森林中节点形状(节点容量)的最多种数
+#define B_FOREST_SHAPE_MAX 8
+// 森林游标的迭代器栈深: 树的元素数不超过2^32, 每个节点至少2个孩子, 高度不超过32
+#define B_FOREST_CURSOR_DEPTH 32
+// b_tree_fit_max_items选择的节点容量范围, 以及相对预期元素数留出的余量
+#define B_TREE_FANOUT_MIN 7
+#define B_TREE_FANOUT_MAX 1023
+#define B_TREE_FANOUT_SLACK 1.25
+// 定长值模式下值的最大字节数, 使一个元素不超过一个缓存行
+#define B_TREE_PAYLOAD_MAX 60
+// 定长值模式下一个元素的字节数: int key之后紧跟payload_size字节的值
+#define B_TREE_POD_ELSIZE(payload_size) (sizeof(int) + (payload_size))
 
 struct B_Tree;
+struct B_Tree_node;
+// 跨越森林中各树的游标, 见b_forest_cursor_new
+typedef struct B_Forest_Cursor B_Forest_Cursor;
+
+// 原地更新的回调: 收到key与当前的值字符串, 返回新的值字符串; 返回old本身或NULL时保持原值, 不写值日志
+typedef const char *(*KV_Update)(int key, const char *old, void *udata);
+// 范围遍历的回调: 按key升序收到每个元素, 返回false时停止遍历
+typedef bool (*KV_Visit)(const KV_Node *node, void *udata);
+
+// B树森林中的一棵树: 只保存根节点、元素数和高度, 根节点为NULL即空树, 第一次插入时才分配节点
+typedef struct B_Forest_Tree {
+    struct B_Tree_node *root;
+    uint32_t count;
+    uint16_t height;
+    uint16_t shape; // 使用的节点形状, 即shared中的下标
+} B_Forest_Tree;
+
+// 共享节点slab的一组KV_Node B树, 节点容量相同的树共享同一份配置;
+// 修改某棵树时把它的状态装入对应的shared头部再写回, 因此修改操作不能并发, 查询只读取配置, 可以并发
+typedef struct B_Forest {
+    struct B_Tree *shared[B_FOREST_SHAPE_MAX]; // 每种节点形状共享的配置(节点容量、分配器、临时元素空间等)
+    int shape_num;         // 节点形状的数量, shared[0]为默认的255项节点
+    B_Forest_Tree *tree;   // 各棵树的状态
+    uint64_t *nonempty;    // 非空树的位图, 第i位对应第i棵树
+    int first, last;       // 第一棵和最后一棵非空树的下标, 森林为空时分别为tree_num和-1
+    Slab *slab;            // 所有树的节点都从这里分配, 释放森林时整体归还
+    Value_Log *vlog;       // 所有树的值字符串都追加到这里, 元素中只存句柄; 定长值模式下为NULL
+    size_t elsize;         // 每个元素的字节数, 即sizeof(KV_Node)或B_TREE_POD_ELSIZE(值的字节数)
+    uint32_t retired;      // b_forest_upsert换下的旧值句柄, 推迟到下一次写入时才失效
+    size_t *fenwick;       // 排名模式下按树下标维护各树元素数的树状数组(下标从1起), 否则为NULL
+    int tree_num;          // 树的数量
+} B_Forest;
 
 // B_Tree_new returns a new B-tree.
 //
@@ -83,6 +134,25 @@ struct B_Tree *B_Tree_clone(struct B_Tree *B_Tree);
 // and B_Tree_oom() returns true.
 const void *B_Tree_set(struct B_Tree *B_Tree, const void *item);
 
+// B_Tree_get_or_set looks up the key of item and inserts item only if no item
+// has that key, in a single descent. Returns a pointer to the item stored
+// under the key, existing or inserted, which the caller may modify in place
+// as long as its ordering is unchanged, until the next write operation.
+// Param inserted, when not NULL, tells whether item was inserted.
+//
+// If the system fails allocate the memory needed then NULL is returned 
+// and B_Tree_oom() returns true.
+void *B_Tree_get_or_set(struct B_Tree *B_Tree, const void *item,
+    bool *inserted);
+
+// B_Tree_get_mut is the same as B_Tree_get but returns the item for in-place
+// modification under the same rules as B_Tree_get_or_set. Nodes shared with
+// a clone are copied along the search path.
+//
+// Returns NULL if item is not found, or if the system fails to allocate the
+// memory needed, in which case B_Tree_oom() returns true.
+void *B_Tree_get_mut(struct B_Tree *B_Tree, const void *key);
+
 // B_Tree_delete removes an item from the B-tree and returns it.
 //
 // Returns NULL if item not found.
@@ -100,6 +170,27 @@ const void *B_Tree_delete(struct B_Tree *B_Tree, const void *key);
 // and B_Tree_oom() returns true.
 const void *B_Tree_load(struct B_Tree *B_Tree, const void *item);
 
+// B_Tree_load_sorted loads count items, stored contiguously and in strictly
+// ascending order, in one call. An empty tree is built bottom-up with every
+// node packed as full as the item count allows, without searching or
+// splitting. Otherwise, or when the tree has an item_clone callback, the
+// items are loaded one at a time with B_Tree_load.
+//
+// Returns false if the system fails to allocate the memory needed, in which
+// case B_Tree_oom() returns true and an empty tree is left unchanged.
+bool B_Tree_load_sorted(struct B_Tree *B_Tree, const void *items,
+    size_t count);
+
+// B_Tree_rebuild_sorted replaces the contents of the tree with count items,
+// stored contiguously and in strictly ascending order, built bottom-up like
+// B_Tree_load_sorted. The previous items are dropped without calling
+// item_free, so they may be passed back in as part of items.
+//
+// Returns false if the system fails to allocate the memory needed, in which
+// case B_Tree_oom() returns true and the tree is left unchanged.
+bool B_Tree_rebuild_sorted(struct B_Tree *B_Tree, const void *items,
+    size_t count);
+
 // B_Tree_pop_min removes the first item in the B_Tree and returns it.
 //
 // Returns NULL if B_Tree is empty.
@@ -183,6 +274,44 @@ bool B_Tree_descend_hint(const struct B_Tree *B_Tree, const void *pivot,
     bool (*iter)(const void *item, void *udata), 
     void *udata, uint64_t *hint);
 
+// B_Tree_HINT_POS marks a hint that holds a predicted relative position
+// instead of per-depth indexes. See B_Tree_pos_hint. Per-depth hints only
+// cover the first seven levels, so they never set this bit.
+#define B_Tree_HINT_POS ((uint64_t)1 << 63)
+
+// B_Tree_pos_hint returns a hint for the *_hint functions telling the search
+// that the key is expected at relative position pos of the tree, where 0.0 is
+// the first item and 1.0 is past the last one. At every level the search
+// probes the predicted index first and gallops outward from it, so an accurate
+// prediction costs a few comparisons instead of a full binary search. The
+// hint is then refined to the position inside the chosen child.
+uint64_t B_Tree_pos_hint(double pos);
+
+// B_Tree_set_node_allocator makes the tree allocate and free its nodes with
+// alloc(udata, size) and release(udata, ptr) instead of the malloc and free
+// passed to B_Tree_new_with_allocator, for node allocators that need a
+// context, such as a slab shared by a group of trees. The tree header itself
+// and iterators still use malloc and free. Call it while the tree is empty.
+void B_Tree_set_node_allocator(struct B_Tree *B_Tree,
+    void *(*alloc)(void *udata, size_t size),
+    void (*release)(void *udata, void *ptr), void *udata);
+
+// B_Tree_set_ranked turns the order-statistic mode on or off. In that mode
+// every branch node also stores the number of items under each of its
+// children, which B_Tree_rank and B_Tree_select need. Keeping the counts
+// costs one increment or decrement per level on every insert and delete and
+// a word per child in branch nodes. Call it while the tree is empty.
+void B_Tree_set_ranked(struct B_Tree *B_Tree, bool ranked);
+
+// B_Tree_rank returns the number of items less than key, in a single descent.
+// The tree must be in the order-statistic mode, see B_Tree_set_ranked.
+size_t B_Tree_rank(const struct B_Tree *B_Tree, const void *key);
+
+// B_Tree_select returns the item at zero-based position index in ascending
+// order, or NULL if index is not less than the item count. The tree must be
+// in the order-statistic mode, see B_Tree_set_ranked.
+const void *B_Tree_select(const struct B_Tree *B_Tree, size_t index);
+
 // B_Tree_set_searcher allows for setting a custom search function.
 void B_Tree_set_searcher(struct B_Tree *B_Tree, 
     int (*searcher)(const void *items, size_t nitems, const void *key, 
@@ -202,24 +331,178 @@ const void *B_Tree_iter_item(struct B_Tree_iter *iter);
 // DEPRECATED: use `B_Tree_new_with_allocator`
 void B_Tree_set_allocator(void *(malloc)(size_t), void (*free)(void*));
 
-// 创建一颗新的存储KV_Node元素的B树
+// 创建一颗新的存储KV_Node元素的B树, 值字符串存放在它自己的值日志中(B树的udata)
+// key比较内联、元素大小在编译期确定, 是LR、Fool和Hash树默认使用的后端
 struct B_Tree *b_tree_create();
 
+// 同b_tree_create, 但使用通用实现(经函数指针比较, 按运行期elsize拷贝), 用于对比测试
+struct B_Tree *b_tree_create_generic();
+
+// 创建一颗定长值模式的B树: 每个元素为int key加payload_size字节的值, 值直接存放在节点中,
+// 没有值日志; payload_size须为sizeof(int)的倍数且不超过B_TREE_PAYLOAD_MAX, 否则返回NULL
+struct B_Tree *b_tree_create_pod(size_t payload_size);
+
 // 判断B树中是否存储了指定key值的元素
 bool b_tree_exist(const struct B_Tree *B_Tree, int key);
 
-// 删除B树中键值为key值得元素(如果有)
+// 删除B树中键值为key值得元素(如果有), 其值在值日志中标记为失效
 void b_tree_erase(const struct B_Tree *B_Tree, int key);
 
-// 向B树中插入(或者更新)键值为key, value值为str字符串的元素
+// 向B树中插入(或者更新)键值为key, value值为str字符串的元素, 字符串追加到值日志, 旧值标记为失效;
+// 失效记录过多时顺带整理值日志(b_tree_compact); 定长值模式下不做任何修改
 void b_tree_insert(const struct B_Tree *B_Tree, int key, const char* s);
 
+// 向空B树中批量装入n个key严格递增的元素, 自底向上构建满节点, 内存不足时返回false;
+// 元素的val须是该B树值日志中的句柄, 无论成功与否都归B树所有; 定长值模式下不做任何修改并返回false
+bool b_tree_bulk_load(struct B_Tree *B_Tree, const KV_Node *items, size_t n);
+
+// 把n个key严格递增的元素并入B树, 重复key以新元素为准, 内存不足时返回false;
+// 元素的val同b_tree_bulk_load; 定长值模式下不做任何修改并返回false
+bool b_tree_merge(struct B_Tree *B_Tree, const KV_Node *items, size_t n);
+
 // 返回键值key对应的B树元素, 若是无则返回NULL
 KV_Node* b_tree_query(const struct B_Tree *B_Tree, int key);
 
+// 同b_tree_query, 但以hint引导B树内的查找, hint可由B_Tree_pos_hint给出
+KV_Node* b_tree_query_hint(const struct B_Tree *B_Tree, int key,
+    uint64_t *hint);
+
+// 返回b_tree_query得到的元素的值字符串, node为NULL时返回NULL; 下一次修改B树之前有效
+const char *b_tree_value(const struct B_Tree *B_Tree, const KV_Node *node);
+
+// 向定长值模式的B树中插入(或者更新)键值为key的元素, 从val复制payload_size字节的值
+void b_tree_insert_pod(const struct B_Tree *B_Tree, int key, const void *val);
+
+// 在定长值模式的B树中查找key, 找到时把值复制到val并返回true
+bool b_tree_query_pod(const struct B_Tree *B_Tree, int key, void *val);
+
+// 把b_tree_query在定长值模式下得到的元素的值复制到val, node为NULL时返回false
+bool b_tree_payload(const struct B_Tree *B_Tree, const KV_Node *node,
+    void *val);
+
+// 整理B树的值日志: 把失效记录过半的段中的有效值搬到新段并改写元素中的句柄, 然后归还这些段
+void b_tree_compact(struct B_Tree *B_Tree);
+
 // 打印B树中节点的信息
 void print_b_tree_node(const struct B_Tree *B_Tree, int key);
 
 // 释放B树内存
 void b_tree_free(struct B_Tree *B_Tree);
+
+// 创建有tree_num棵空树的B树森林, 只分配各树的状态数组
+B_Forest *b_forest_create(int tree_num);
+
+// 释放B树森林及其所有树的内存
+void b_forest_free(B_Forest *forest);
+
+// 返回森林中第i棵树的元素数
+size_t b_forest_count(const B_Forest *forest, int i);
+
+// 返回第first到第last棵树的元素总数, first大于last时为0; 排名模式下取自树状数组, 否则逐棵累加
+size_t b_forest_count_range(const B_Forest *forest, int first, int last);
+
+// 返回森林中第i棵树的高度, 空树为0
+size_t b_forest_height(const B_Forest *forest, int i);
+
+// 返回预期存放expected个元素的B树应使用的节点容量: 取2^k-1阶梯上不小于expected的B_TREE_FANOUT_SLACK倍的
+// 最小值, 使这些元素尽量放进一个节点, 范围为[B_TREE_FANOUT_MIN, B_TREE_FANOUT_MAX],
+// 再增大到叶子节点(每个元素elsize字节)所占缓存行数不变的最大值
+size_t b_tree_fit_max_items(size_t expected, size_t elsize);
+
+// 把森林切换为定长值模式, 每个值payload_size字节(要求同b_tree_create_pod), 释放值日志;
+// 只能在所有树均为空时调用, 已设置的节点形状保留; payload_size不合要求时返回false, 森林保持原样
+bool b_forest_set_payload(B_Forest *forest, size_t payload_size);
+
+// 让森林中的第i棵树使用节点容量为max_items的节点, 只能在该树为空时调用;
+// 形状种数已满时使用已有形状中容量不小于max_items的最小一种
+void b_forest_set_max_items(B_Forest *forest, int i, size_t max_items);
+
+// 开启或关闭森林的排名模式(B_Tree_set_ranked), 只能在所有树均为空时调用; 开启后各树的分支节点记录
+// 每个孩子子树的元素数, 森林另以树状数组维护各树的元素数, 每次插入删除多付出每层一次计数和一次O(log tree_num)的更新
+void b_forest_set_ranked(B_Forest *forest, bool enable);
+
+// 返回森林占用的内存字节数: 各树状态数组、非空位图、树状数组、slab的全部arena以及值日志
+size_t b_forest_memory(const B_Forest *forest);
+
+// 整理森林共用的值日志, 同b_tree_compact, 但遍历所有树
+void b_forest_compact(const B_Forest *forest);
+
+// 返回b_forest_query得到的元素的值字符串, 同b_tree_value; 定长值模式下返回NULL
+const char *b_forest_value(const B_Forest *forest, const KV_Node *node);
+
+// 把b_forest_query在定长值模式下得到的元素的值复制到val, 同b_tree_payload
+bool b_forest_payload(const B_Forest *forest, const KV_Node *node, void *val);
+
+// 以下三个函数以及b_forest_insert、b_forest_merge只用于字符串值模式, 定长值模式下(vlog为NULL)不做任何修改,
+// 分别返回NULL、NULL(inserted为false)、false以及false
+// 向第i棵树中插入(或者更新)键值为key的元素, 只下降一次; 返回被替换的旧值字符串, 原本没有该key时返回NULL,
+// 旧值推迟到森林的下一次写入时才失效, 因此在那之前有效; ok非NULL时写入本次是否成功,
+// 值日志或节点内存不足(以及定长值模式)时为false, 此时返回NULL且树不变
+const char *b_forest_upsert(const B_Forest *forest, int i, int key,
+    const char *s, bool *ok);
+
+// 在第i棵树中查找key, 没有时插入值为s的元素, 只下降一次, 已有该key时不写值日志;
+// 返回该key对应的元素, inserted非NULL时写入是否新插入, 内存不足时返回NULL
+KV_Node* b_forest_get_or_insert(const B_Forest *forest, int i, int key,
+    const char *s, bool *inserted);
+
+// 在第i棵树中找到key对应的元素并以fn的返回值原地替换其值, 只下降一次; 没有该key时返回false
+bool b_forest_update(const B_Forest *forest, int i, int key, KV_Update fn,
+    void *udata);
+
+// 同B_Tree_ascend, 作用于森林中的第i棵树, 可与查询并发
+bool b_forest_ascend(const B_Forest *forest, int i, const void *pivot,
+    bool (*iter)(const void *item, void *udata), void *udata);
+
+// 把第i棵树的根节点预取进缓存
+void b_forest_prefetch(const B_Forest *forest, int i);
+
+// 按key升序对第first到第last棵树中key落在[lo, hi]内的元素调用fn, 这些树须按key有序排列;
+// 扫描一棵树时预取下一棵树的根节点, fn返回false时提前结束并返回false
+bool b_forest_range(const B_Forest *forest, int first, int last, int lo,
+    int hi, KV_Visit fn, void *udata);
+
+// 创建森林的游标, 按树的下标顺序、树内按key升序遍历所有元素, 自动跳过空树; 整个遍历只分配这一个迭代器.
+// 以下移动函数在游标停在某个元素上时返回true, 越过两端时返回false, 之后须重新定位;
+// 森林被修改后游标失效, 也须重新定位
+B_Forest_Cursor *b_forest_cursor_new(const B_Forest *forest);
+void b_forest_cursor_free(B_Forest_Cursor *cursor);
+// 停在第i棵树中第一个key不小于key的元素上, 该树中没有时停在其后第一棵非空树的第一个元素上
+bool b_forest_cursor_seek(B_Forest_Cursor *cursor, int i, int key);
+// 停在第一棵(最后一棵)非空树的第一个(最后一个)元素上
+bool b_forest_cursor_first(B_Forest_Cursor *cursor);
+bool b_forest_cursor_last(B_Forest_Cursor *cursor);
+// 移动到下一个(上一个)元素, 当前树走完时进入下一棵(上一棵)非空树
+bool b_forest_cursor_next(B_Forest_Cursor *cursor);
+bool b_forest_cursor_prev(B_Forest_Cursor *cursor);
+// 返回游标所在元素的副本, 游标不在元素上时返回NULL; 下一次移动游标之前有效
+const KV_Node *b_forest_cursor_item(const B_Forest_Cursor *cursor);
+
+// 以下四个函数要求各树按下标即按key有序排列(如LR树与fool tree), 返回的元素在下一次修改森林之前有效
+// 返回第一个key不小于key的元素, 从第i棵树查起, 没有时落到其后第一棵非空树的最小元素, 都没有时返回NULL
+KV_Node* b_forest_ceiling(const B_Forest *forest, int i, int key);
+// 返回最后一个key不大于key的元素, 从第i棵树查起, 没有时落到其前最后一棵非空树的最大元素
+KV_Node* b_forest_floor(const B_Forest *forest, int i, int key);
+// 返回整个森林的最小(最大)元素, 即第一棵(最后一棵)非空树的B_Tree_min(B_Tree_max), 森林为空时返回NULL
+KV_Node* b_forest_min(const B_Forest *forest);
+KV_Node* b_forest_max(const B_Forest *forest);
+
+// 以下两个函数要求森林处于排名模式, 且各树按下标即按key有序排列
+// 返回整个森林中key小于key的元素数, key路由到第i棵树: 前i棵树的元素数取自树状数组, 再加上第i棵树内的排名
+size_t b_forest_rank(const B_Forest *forest, int i, int key);
+// 返回整个森林中按key升序第index个(从0起)元素, 超出元素总数时返回NULL
+KV_Node* b_forest_select(const B_Forest *forest, size_t index);
+
+// 以下同对应的b_tree_*函数, 作用于森林中的第i棵树
+bool b_forest_exist(const B_Forest *forest, int i, int key);
+void b_forest_erase(const B_Forest *forest, int i, int key);
+void b_forest_insert(const B_Forest *forest, int i, int key, const char *s);
+void b_forest_insert_pod(const B_Forest *forest, int i, int key,
+    const void *val);
+bool b_forest_query_pod(const B_Forest *forest, int i, int key, void *val);
+bool b_forest_merge(const B_Forest *forest, int i, const KV_Node *items,
+    size_t n);
+KV_Node* b_forest_query(const B_Forest *forest, int i, int key);
+KV_Node* b_forest_query_hint(const B_Forest *forest, int i, int key,
+    uint64_t *hint);
 #endif
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef DISTRIBUTION_H_
+#define DISTRIBUTION_H_
+#include "utility.h"
+// ---------------------宏定义--------------------
+#define MIX_MAX 4              // 高斯混合模型的最大分量数
+#define KS_MAX_POINTS 20000    // 计算KS统计量时最多使用的样本点数
+#define EM_ITERATION 100       // 高斯混合模型EM算法的迭代次数
+#define FIT_POINT_PER_BASE 4   // 线性拟合时每个纵坐标单位(一颗B树)所取的点数
+#define FIT_POINT_MIN 16       // 线性拟合的最少取点数
+#define FIT_POINT_MAX 500      // 线性拟合的最多取点数
+
+// --------------------结构体定义------------------
+// 支持的分布族
+typedef enum Dist_Type {
+    DIST_GAUSSIAN = 0, // 正态分布
+    DIST_UNIFORM,      // 均匀分布
+    DIST_LOGNORMAL,    // 对数正态分布
+    DIST_EXPONENTIAL,  // 指数分布
+    DIST_ZIPF,         // Zipf(截断幂律)分布
+    DIST_MIXTURE,      // 高斯混合分布
+    DIST_TYPE_NUM,
+} Dist_Type;
+
+// 一个具体的分布, 各字段的含义取决于type
+typedef struct Distribution {
+    Dist_Type type;
+    double mean, sigma; // 正态: 均值/标准差; 对数正态: ln(x - shift)的均值/标准差
+    double lo, hi;      // 均匀/Zipf: 取值区间[lo, hi]
+    double shift;       // 对数正态/指数: 平移量, 取值范围为(shift, +inf)
+    double lambda;      // 指数: 速率参数
+    double s;           // Zipf: 幂指数, 密度正比于(x - lo + 1)^-s
+
+    int mix_num;                // 高斯混合: 分量数量
+    double weight[MIX_MAX];     // 高斯混合: 各分量权重
+    double mix_mean[MIX_MAX];   // 高斯混合: 各分量均值
+    double mix_sigma[MIX_MAX];  // 高斯混合: 各分量标准差
+} Distribution;
+// ---------------------函数原型-------------------
+// 各分布族的构造函数
+Distribution dist_gaussian(double mean, double sigma);
+Distribution dist_uniform(double lo, double hi);
+Distribution dist_lognormal(double shift, double mu, double sigma);
+Distribution dist_exponential(double shift, double lambda);
+Distribution dist_zipf(double lo, double hi, double s);
+Distribution dist_mixture(int mix_num, const double *weight, const double *mean,
+                          const double *sigma);
+// 返回分布族的名称
+const char *dist_name(const Distribution *dist);
+// 计算累积分布函数值
+double dist_cdf(const Distribution *dist, double x);
+// 基于累积分布函数的值y求自变量x
+double dist_icdf(const Distribution *dist, double y);
+// 以逆变换采样产生一个服从该分布的(INT_MIN, INT_MAX)之间的随机整数
+int dist_rand_integer(const Distribution *dist);
+// 创建服从该分布的n个不重合的有序整数
+int *dist_generate_sorted_arr(const Distribution *dist, int n);
+// 计算有序样本相对于该分布的Kolmogorov-Smirnov统计量
+double dist_ks_statistic(const Distribution *dist, const int *sorted, int n);
+// 对每个分布族估计参数, 返回KS统计量最小者, ks非NULL时写入其KS统计量
+Distribution dist_fit(const int *sorted, int n, double *ks);
+// 对[left, right]段的分布函数进行线性拟合, 纵坐标重映射到[0, base)
+void dist_linear_fitting(const Distribution *dist, int left, int right,
+                         double *k, double *b, int base);
+
+#endif // DISTRIBUTION_H_
@@ -9,13 +9,17 @@ typedef struct Fool_Tree_Root{
     int b_tree_num;// 内部的B树数量
     long long range_num;// 每个B树负责的key的数量
 
-    struct B_Tree** b_tree_node;// B树子节点指针数组
+    B_Forest* forest;// B树子节点森林, 第一次插入时才分配节点
 }Fool_Tree_Root;
 // ---------------------函数原型-------------------
 // 创建一颗fool tree， 返回其根节点指针
 Fool_Tree_Root* fool_tree_create(int left, int right, int b_tree_num);
-// 查找分管当前key值的是哪一颗B树并返回其节点指针
-struct B_Tree* fool_find_b_tree(const Fool_Tree_Root* root, int key);
+// 创建一颗定长值模式的fool tree, 值为payload_size字节的定长数据, 直接存放在B树节点中;
+// 同lr_tree_set_payload, 此后写入值字符串的函数不做任何修改并以写入失败返回; payload_size不合要求时返回NULL
+Fool_Tree_Root* fool_tree_create_pod(int left, int right, int b_tree_num,
+                                     size_t payload_size);
+// 查找分管当前key值的是哪一颗B树并返回其在森林中的下标
+int fool_find_partition(const Fool_Tree_Root* root, int key);
 // 释放fool tree的内存
 void fool_tree_free(Fool_Tree_Root* root);
 // 判断fool tree中是否存储了指定key值的元素
@@ -24,8 +28,40 @@ bool fool_tree_exist(const Fool_Tree_Root* root, int key);
 void fool_tree_erase(const Fool_Tree_Root* root, int key);
 // 向fool tree中插入(或者更新)键值为key, value值为str字符串的元素
 void fool_tree_insert(const Fool_Tree_Root* root, int key, const char* s);
+// 插入(或者更新)键值为key的元素, 只下降一次; 返回被替换的旧值字符串, 原本没有该key时返回NULL,
+// ok非NULL时写入本次是否成功
+const char* fool_tree_upsert(const Fool_Tree_Root* root, int key, const char* s,
+                             bool* ok);
+// 查找key, 没有时插入值为s的元素; 返回该key对应的元素, inserted非NULL时写入是否新插入
+KV_Node* fool_tree_get_or_insert(const Fool_Tree_Root* root, int key, const char* s,
+                               bool* inserted);
+// 找到key对应的元素并以fn的返回值原地替换其值, 同lr_tree_update
+bool fool_tree_update(const Fool_Tree_Root* root, int key, KV_Update fn,
+                      void* udata);
+// 按key升序对key落在[lo, hi]内的元素调用fn, 同lr_tree_range
+bool fool_tree_range(const Fool_Tree_Root* root, int lo, int hi, KV_Visit fn,
+                     void* udata);
+// 创建遍历fool tree的游标并定位, 同lr_tree_cursor_new与lr_tree_cursor_seek
+B_Forest_Cursor* fool_tree_cursor_new(const Fool_Tree_Root* root);
+bool fool_tree_cursor_seek(const Fool_Tree_Root* root, B_Forest_Cursor* cursor,
+                           int key);
+// 同lr_tree_ceiling, lr_tree_floor, lr_tree_min和lr_tree_max
+KV_Node* fool_tree_ceiling(const Fool_Tree_Root* root, int key);
+KV_Node* fool_tree_floor(const Fool_Tree_Root* root, int key);
+KV_Node* fool_tree_min(const Fool_Tree_Root* root);
+KV_Node* fool_tree_max(const Fool_Tree_Root* root);
+// 同lr_tree_set_ranked, lr_tree_rank和lr_tree_select
+void fool_tree_set_ranked(Fool_Tree_Root* root, bool enable);
+size_t fool_tree_rank(const Fool_Tree_Root* root, int key);
+KV_Node* fool_tree_select(const Fool_Tree_Root* root, size_t index);
 // 返回键值key对应的fool tree元素, 若是无则返回NULL
 KV_Node* fool_tree_query(const Fool_Tree_Root* root, int key);
+// 返回fool_tree_query得到的元素的值字符串, node为NULL时返回NULL; 下一次修改fool tree之前有效
+const char* fool_tree_value(const Fool_Tree_Root* root, const KV_Node* node);
+// 定长值模式下插入(或者更新)键值为key的元素, 从val复制payload_size字节的值
+void fool_tree_insert_pod(const Fool_Tree_Root* root, int key, const void* val);
+// 定长值模式下查找key, 找到时把值复制到val并返回true
+bool fool_tree_query_pod(const Fool_Tree_Root* root, int key, void* val);
 // 打印fool tree中节点的信息
 void print_fool_tree_node(const Fool_Tree_Root* root, int key);
 
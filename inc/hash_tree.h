@@ -8,13 +8,17 @@ typedef struct Hash_Tree_Root{
     int left, right;// 负责的key值的范围[left, right]
     int b_tree_num;// 内部的B树数量
 
-    struct B_Tree** b_tree_node;// B树子节点指针数组
+    B_Forest* forest;// B树子节点森林, 第一次插入时才分配节点
 }Hash_Tree_Root;
 // ---------------------函数原型-------------------
 // 创建一颗hash tree， 返回其根节点指针
 Hash_Tree_Root* hash_tree_create(int left, int right, int b_tree_num);
-// 查找分管当前key值的是哪一颗B树并返回其节点指针
-struct B_Tree* hash_find_b_tree(const Hash_Tree_Root* root, int key);
+// 创建一颗定长值模式的hash tree, 值为payload_size字节的定长数据, 直接存放在B树节点中;
+// 同lr_tree_set_payload, 此后写入值字符串的函数不做任何修改并以写入失败返回; payload_size不合要求时返回NULL
+Hash_Tree_Root* hash_tree_create_pod(int left, int right, int b_tree_num,
+                                     size_t payload_size);
+// 查找分管当前key值的是哪一颗B树并返回其在森林中的下标
+int hash_find_partition(const Hash_Tree_Root* root, int key);
 // 释放hash tree的内存
 void hash_tree_free(Hash_Tree_Root* root);
 // 判断hash tree中是否存储了指定key值的元素
@@ -23,8 +27,24 @@ bool hash_tree_exist(const Hash_Tree_Root* root, int key);
 void hash_tree_erase(const Hash_Tree_Root* root, int key);
 // 向hash tree中插入(或者更新)键值为key, value值为str字符串的元素
 void hash_tree_insert(const Hash_Tree_Root* root, int key, const char* s);
+// 插入(或者更新)键值为key的元素, 只下降一次; 返回被替换的旧值字符串, 原本没有该key时返回NULL,
+// ok非NULL时写入本次是否成功
+const char* hash_tree_upsert(const Hash_Tree_Root* root, int key, const char* s,
+                             bool* ok);
+// 查找key, 没有时插入值为s的元素; 返回该key对应的元素, inserted非NULL时写入是否新插入
+KV_Node* hash_tree_get_or_insert(const Hash_Tree_Root* root, int key, const char* s,
+                               bool* inserted);
+// 找到key对应的元素并以fn的返回值原地替换其值, 同lr_tree_update
+bool hash_tree_update(const Hash_Tree_Root* root, int key, KV_Update fn,
+                      void* udata);
 // 返回键值key对应的hash tree元素, 若是无则返回NULL
 KV_Node* hash_tree_query(const Hash_Tree_Root* root, int key);
+// 返回hash_tree_query得到的元素的值字符串, node为NULL时返回NULL; 下一次修改hash tree之前有效
+const char* hash_tree_value(const Hash_Tree_Root* root, const KV_Node* node);
+// 定长值模式下插入(或者更新)键值为key的元素, 从val复制payload_size字节的值
+void hash_tree_insert_pod(const Hash_Tree_Root* root, int key, const void* val);
+// 定长值模式下查找key, 找到时把值复制到val并返回true
+bool hash_tree_query_pod(const Hash_Tree_Root* root, int key, void* val);
 // 打印hash tree中节点的信息
 void print_hash_tree_node(const Hash_Tree_Root* root, int key);
 
@@ -0,0 +1,51 @@
+#ifndef LR_ROUTE_H_
+#define LR_ROUTE_H_
+#include "utility.h"
+// ---------------------宏定义--------------------
+#define MAX_LAYER 3 // 线性回归树的最高层数(包含叶子节点层)
+#define SIMD_WIDTH 8 // SIMD路由表每个块中的endpoint数量(一次AVX2比较8个int)
+
+// --------------------结构体定义------------------
+// 根节点路由方式
+typedef enum LR_Route_Mode {
+    LR_ROUTE_BISECT = 0, // 在right_endpoint数组上二分
+    LR_ROUTE_RMI,        // 逐级线性模型预测 + 有界的指数搜索修正
+    LR_ROUTE_EYTZINGER,  // Eytzinger(BFS序)副本上的无分支搜索 + 预取
+    LR_ROUTE_SIMD,       // 每块SIMD_WIDTH个endpoint的多叉隐式树, AVX2逐块比较
+} LR_Route_Mode;
+
+// RMI中的一个线性模型, 预测key在right_endpoint中的下标
+typedef struct LR_Route_Model {
+    double k, b; // 预测下标pos = k * key + b
+    int lo, hi;  // 路由到该模型的key的答案必然落在[lo, hi]之内(仅最后一级使用)
+} LR_Route_Model;
+
+// 根节点的路由表, 负责找到第一个大于等于key的right_endpoint的下标
+typedef struct LR_Route {
+    LR_Route_Mode mode;
+    int n;               // right_endpoint的长度, 即叶子节点数量
+    const int *endpoint; // 指向根节点的right_endpoint数组, 不归路由表所有
+
+    int stage_num;                     // RMI的模型层数(不包含叶子节点层)
+    int fanout[MAX_LAYER];             // 每一层的模型数量, 第0层恒为1
+    LR_Route_Model *stage[MAX_LAYER];  // 每一层的模型数组
+
+    int *eytz;     // Eytzinger序的endpoint副本, 下标从1开始
+    int *eytz_idx; // eytz[i]在endpoint中的原下标
+    int block_num; // SIMD路由表的块数
+    int *block;    // SIMD路由表, 每块SIMD_WIDTH个endpoint, 不足处以INT_MAX填充
+    int *block_idx; // block[i]在endpoint中的原下标
+} LR_Route;
+// ---------------------函数原型-------------------
+// 初始化一个基于二分的路由表
+void lr_route_init(LR_Route *route, const int *endpoint, int n);
+// 按指定方式构建路由表, RMI使用默认的两层结构
+void lr_route_build(LR_Route *route, LR_Route_Mode mode);
+// 训练一个stage_num层的RMI, fanout[i]为第i + 1层的模型数量(共stage_num - 1个)
+void lr_route_build_rmi(LR_Route *route, int stage_num, const int *fanout);
+// 返回第一个大于等于key的right_endpoint的下标(不存在时返回n - 1)
+int lr_route_find(const LR_Route *route, int key);
+// 释放路由表中的模型内存, 并退回二分方式
+void lr_route_free(LR_Route *route);
+
+#endif // LR_ROUTE_H_
@@ -1,38 +1,129 @@
 #ifndef LR_TREE_H_
 #define LR_TREE_H_
+#include <pthread.h>
 #include "b_tree.h"
+#include "distribution.h"
+#include "lr_route.h"
 #include "utility.h"
 // ---------------------宏定义--------------------
 #define MAX_BRANCH 100 // 线性回归树的分支的最大数量
-#define MAX_LAYER 3    // 线性回归树的最高层数
+#define FIXED_MAX_SHIFT 60 // 定点整数模型中斜率缩放的最大移位数
+#define SPLINE_KNOT 8 // 每个样条模型的节点数, 8个节点恰好占一个缓存行
+#define SPLINE_MIN_ERROR 0.5 // 直线模型的最大误差(以B树个数计)超过该值时才尝试样条模型
+#define SPLINE_PROBE 64 // 估计模型误差时在每个叶子上取的最多探测点数
+#define HINT_MIN_ITEMS 32 // B树元素少于该值时直接二分比从预测位置倍增探测更快, 不使用hint
+#define BUILD_THREAD_MAX 16 // 并行构建叶子时的最大线程数
+#define BUILD_LEAF_PER_THREAD 4096 // 每个构建线程至少负责的叶子数, 叶子较少时不值得开线程
 
 // --------------------结构体定义------------------
-// 线性回归树的叶子节点
+// 线性回归树的叶子节点, 以数组形式连续存放, 每个32字节(两个叶子恰好占一个缓存行)
 typedef struct LR_Tree_Leaf {
-    int left, right; // 该叶子节点负责的key值的范围[left, right]
-    double k, b;     // 拟合直线的斜率和截距
-    int b_tree_num;  // 该叶子节点下B树数量
-
-    struct B_Tree **b_tree_node; // B树子节点指针数组
+    double k, b;    // 拟合直线的斜率和截距
+    int left;       // 该叶子节点负责的key值范围的左端点, 右端点即right_endpoint中的对应值
+    int knot;       // 模型标记: 为-1时使用直线模型, 否则为样条节点在knot池中的起始下标
+    int base;       // 该叶子的第一颗B树在全局B树表中的下标
+    int b_tree_num; // 该叶子节点下B树数量
 } LR_Tree_Leaf;
 
+// 样条模型的节点, 每个叶子的SPLINE_KNOT个节点按x递增连续存放, 相邻节点间线性插值
+typedef struct LR_Tree_Knot {
+    int x;   // key值
+    float y; // 该key值处的B树预测值, 落在[0, b_tree_num]之上
+} LR_Tree_Knot;
+
+// 叶子节点模型的定点整数形式, 与LR_Tree_Leaf一一对应, 同样每个32字节
+// 预测值 = ((key - origin) * mult + c) >> shift, 其中c为直线在origin处的取值
+typedef struct LR_Tree_Fixed {
+    int64_t mult;   // 斜率k * 2^shift
+    int64_t c;      // (k * origin + b) * 2^shift
+    int origin;     // 相对原点, 取left与直线零点中较大者, 使c的绝对值不超过b_tree_num
+    int shift;      // 缩放的移位数, 为-1时表示该叶子使用样条模型
+    int base;       // 同LR_Tree_Leaf
+    int b_tree_num; // 同LR_Tree_Leaf
+} LR_Tree_Fixed;
+
 // 线性回归树的根节点
 typedef struct LR_Tree_Root {
     int leaf_num;        // 叶子节点的数量
     int left, right;     // 该节点负责的key值的范围[left, right]
-    int *right_endpoint; // 按概率均分之后每一段的右端点
+    int b_tree_total;    // 全局B树表的长度
+    int *right_endpoint; // 按概率均分之后每一段的右端点(缓存行对齐)
+    LR_Route route;      // 在right_endpoint上找到叶子节点的路由表
 
-    LR_Tree_Leaf **leaf_node; // 叶子节点指针数组
+    LR_Tree_Leaf *leaf;          // 叶子节点数组(缓存行对齐)
+    LR_Tree_Fixed *fixed;        // 定点整数模型数组, 为NULL时使用leaf中的double模型
+    bool hint;                   // 为true时以模型预测的B树内相对位置引导B树内的查找
+    LR_Tree_Knot *knot;          // 样条节点池(缓存行对齐), 仅直线拟合误差较大的叶子使用
+    int knot_num, knot_cap;      // 样条节点池的已用长度和容量
+    B_Forest *forest;            // 全局B树森林, 叶子i的B树位于[base, base + b_tree_num)
 } LR_Tree_Root;
 // ---------------------函数原型-------------------
-// 基于正态分布特征创建一个线性回归树, 并返回其根节点指针
+// 基于正态分布特征创建一个线性回归树, 并返回其根节点指针, route_mode为根节点路由方式,
+// expected为预期存放的元素总数, 大于0时按模型给出的预期元素数为各B树选择节点容量(见lr_tree_create_dist)
 LR_Tree_Root *lr_tree_create(double mean, double sigma, int branch,
-                             int b_tree_num, int left, int right);
-// 对划归的每一段进行线性拟合, 创建叶子节点并分配若干B树子节点
-LR_Tree_Leaf *lr_tree_leaf_create(double mean, double sigma, int b_tree_num,
-                                  int left, int right);
-// 基于key值找到分治该key值的那个B树并返回其指针
-struct B_Tree *find_b_tree(const LR_Tree_Root *root, int key);
+                             int b_tree_num, int left, int right,
+                             LR_Route_Mode route_mode, int expected);
+// 基于任意分布的累积分布函数等概率划分key值空间, 创建一个线性回归树
+// 端点求解与叶子拟合均按叶子区间分给多个线程并行完成; expected大于0时, 以叶子模型划给每个B树的
+// 概率质量乘以expected作为其预期元素数, 选择节点容量(b_tree_fit_max_items), 为0时使用默认节点容量
+LR_Tree_Root *lr_tree_create_dist(const Distribution *dist, int branch,
+                                  int b_tree_num, int left, int right,
+                                  LR_Route_Mode route_mode, int expected);
+// 基于有序key样本的经验分位数创建一个线性回归树, 并返回其根节点指针, route_mode同上;
+// 以下几种由样本建树的函数均按落入各B树的(数据)样本数选择节点容量
+LR_Tree_Root *lr_tree_create_from_keys(const int *sorted, int n, int branch,
+                                       int b_tree_num, int left, int right,
+                                       LR_Route_Mode route_mode);
+// 基于带权有序样本创建线性回归树, 按累计权重等分key值空间, 叶子拟合同样以累计权重为纵坐标
+// keys严格递增, weight[i] >= 0为keys[i]的权重(如访问频率), 全为1时即退化为按key数量均分
+LR_Tree_Root *lr_tree_create_weighted(const int *keys, const double *weight,
+                                      int n, int branch, int b_tree_num,
+                                      int left, int right,
+                                      LR_Route_Mode route_mode);
+// 基于数据key与采样的查询轨迹创建线性回归树, 使各B树承担的期望操作量接近
+// 数据key每次出现的权重为(1 - alpha) / n, 查询key每次出现的权重为alpha / m,
+// alpha = 0即按key数量均分, alpha = 1即只按访问量均分
+LR_Tree_Root *lr_tree_create_workload(const int *sorted, int n,
+                                      const int *trace, int m, double alpha,
+                                      int branch, int b_tree_num, int left,
+                                      int right, LR_Route_Mode route_mode);
+// 同上, 但访问负载以直方图给出: 第t个桶为(bucket_right[t - 1], bucket_right[t]],
+// 其访问频率freq[t]均摊到落在桶内的数据key上
+LR_Tree_Root *lr_tree_create_histogram(const int *sorted, int n,
+                                       const int *bucket_right,
+                                       const double *freq, int bucket_num,
+                                       double alpha, int branch,
+                                       int b_tree_num, int left, int right,
+                                       LR_Route_Mode route_mode);
+// 对第i个叶子负责的key值段拟合分布函数, 按探测误差在直线与样条模型中择优写入叶子节点
+void lr_tree_leaf_fit(LR_Tree_Root *root, int i, const Distribution *dist);
+// 将根节点的二分替换为layer层(含叶子层)的RMI, fanout[i]为第i + 2层的模型数量
+void lr_tree_build_rmi(LR_Tree_Root *root, int layer, const int *fanout);
+// 开启(或关闭)定点整数模型, 路由时以一次整数乘法和移位代替double运算
+// 在b_tree_num <= 1024时, 仅当double预测值与某个整数的距离小于2^-20时,
+// 两者选出的B树才可能相差1
+void lr_tree_set_fixed(LR_Tree_Root *root, bool enable);
+// 基于key值找到分治该key值的那个B树在全局B树表中的下标
+int lr_tree_find_partition(const LR_Tree_Root *root, int key);
+// 以有序样本落在各B树中的数量作为预期元素数, 重新为每个B树选择节点容量(b_tree_fit_max_items),
+// 覆盖创建时按模型选择的节点容量, 用于实际数据偏离建树分布, 或切换为定长值模式后按实际元素大小取整;
+// 只能在B树均为空时调用
+void lr_tree_tune_fanout(LR_Tree_Root *root, const int *sorted, int n);
+// 同lr_tree_find_partition, 并将key在该B树内的预测相对位置([0, 1])写入pos
+int lr_tree_locate(const LR_Tree_Root *root, int key, double *pos);
+// 开启(或关闭, 默认开启)模型引导的B树内查找, 查询时以lr_tree_locate的pos作为B树的hint
+// 仅对只有一层且元素不少于HINT_MIN_ITEMS的B树生效, 其余B树仍直接二分
+void lr_tree_set_hint(LR_Tree_Root *root, bool enable);
+// 切换为定长值模式: 值为payload_size字节的定长数据, 直接存放在B树节点中, 没有值日志;
+// 须在创建之后、第一次插入之前调用, 之后以lr_tree_insert_pod和lr_tree_query_pod读写,
+// lr_tree_exist和lr_tree_erase照常使用; 写入或读取值字符串的函数(lr_tree_insert, lr_tree_upsert,
+// lr_tree_get_or_insert, lr_tree_update, lr_tree_merge, lr_tree_bulk_load)要求值日志存在, 此后调用不做任何修改:
+// lr_tree_insert直接返回, 其余函数同写入失败, 返回NULL或false
+// payload_size须为sizeof(int)的倍数且不超过B_TREE_PAYLOAD_MAX, 否则返回false并保持字符串值模式
+bool lr_tree_set_payload(LR_Tree_Root *root, size_t payload_size);
+// 开启(或关闭, 默认关闭)排名模式, 之后才能调用lr_tree_rank和lr_tree_select; 须在第一次插入之前调用.
+// 开启后B树的分支节点记录各孩子子树的元素数, 各B树的元素数另以树状数组汇总, 插入删除因此略慢
+void lr_tree_set_ranked(LR_Tree_Root *root, bool enable);
 // 释放线性回归树的内存
 void lr_tree_free(LR_Tree_Root *root);
 // 判断线性回归树中是否存储了指定key值的元素
@@ -41,8 +132,62 @@ bool lr_tree_exist(const LR_Tree_Root *lr_tree, int key);
 void lr_tree_erase(const LR_Tree_Root *lr_tree, int key);
 // 向线性回归树中插入(或者更新)键值为key, value值为str字符串的元素
 void lr_tree_insert(const LR_Tree_Root *lr_tree, int key, const char *s);
+// 插入(或者更新)键值为key的元素, 只路由一次、在B树中只下降一次; 返回被替换的旧值字符串,
+// 原本没有该key时返回NULL; 旧值在下一次修改线性回归树之前有效; ok非NULL时写入本次是否成功,
+// 内存不足时为false, 以便与新插入区分
+const char *lr_tree_upsert(const LR_Tree_Root *lr_tree, int key, const char *s,
+                           bool *ok);
+// 查找key, 没有时插入值为s的元素, 已有该key时不写入值; 返回该key对应的元素,
+// inserted非NULL时写入是否新插入, 内存不足时返回NULL
+KV_Node *lr_tree_get_or_insert(const LR_Tree_Root *lr_tree, int key,
+                               const char *s, bool *inserted);
+// 找到key对应的元素并以fn(key, 旧值, udata)的返回值原地替换其值, fn返回旧值本身时不写入;
+// 没有该key时返回false且不调用fn
+bool lr_tree_update(const LR_Tree_Root *lr_tree, int key, KV_Update fn,
+                    void *udata);
+// 把升序的key数组中的n个元素并入线性回归树, vals为NULL时value为空串, 重复key以后者为准;
+// 一次遍历把输入切分到各B树, 每段由b_tree_merge并入; 内存不足时返回false
+bool lr_tree_merge(const LR_Tree_Root *lr_tree, const int *keys,
+                   const char **vals, int n);
+// 向空的线性回归树批量装入, 即lr_tree_merge, 各B树均自底向上直接构建满节点
+bool lr_tree_bulk_load(const LR_Tree_Root *lr_tree, const int *keys,
+                       const char **vals, int n);
+// 按key升序对key落在[lo, hi]内的元素调用fn(元素, udata), fn返回false时提前结束并返回false;
+// lo只路由一次, 之后依次扫描相邻的B树, 直到hi所在的B树
+bool lr_tree_range(const LR_Tree_Root *lr_tree, int lo, int hi, KV_Visit fn,
+                   void *udata);
+// 估计key落在[lo, hi]内的元素个数, 不访问B树节点: lo与hi之间的B树整棵落在区间内, 取其精确元素数;
+// lo与hi所在的两棵B树按叶子模型预测的相对位置(同lr_tree_locate)按比例估计. 真实个数必在
+// [估计值 - *error, 估计值 + *error]之内(error可为NULL), 误差只来自两端的B树, 不超过它们的元素数之和
+double lr_tree_estimate_count(const LR_Tree_Root *lr_tree, int lo, int hi,
+                              double *error);
+// 创建遍历线性回归树的游标, 以b_forest_cursor_*移动, 用b_forest_cursor_free释放;
+// B树在全局B树表中按key有序, 游标因此按key升序(prev为降序)跨越各B树
+B_Forest_Cursor *lr_tree_cursor_new(const LR_Tree_Root *lr_tree);
+// 把游标定位到第一个key不小于key的元素上, 只路由一次; 没有这样的元素时返回false
+bool lr_tree_cursor_seek(const LR_Tree_Root *lr_tree, B_Forest_Cursor *cursor,
+                         int key);
+// 返回第一个key不小于key的元素, 没有时返回NULL; 只路由一次, 预测的B树中没有时落到其后的B树
+KV_Node *lr_tree_lower_bound(const LR_Tree_Root *lr_tree, int key);
+// 同lr_tree_lower_bound, 即不小于key的最小元素
+KV_Node *lr_tree_ceiling(const LR_Tree_Root *lr_tree, int key);
+// 返回最后一个key不大于key的元素, 没有时返回NULL; 预测的B树中没有时落到其前的B树
+KV_Node *lr_tree_floor(const LR_Tree_Root *lr_tree, int key);
+// 返回key最小(最大)的元素, 树为空时返回NULL; 森林维护首末非空B树, 不必逐个B树查找
+KV_Node *lr_tree_min(const LR_Tree_Root *lr_tree);
+KV_Node *lr_tree_max(const LR_Tree_Root *lr_tree);
+// 返回key小于key的元素个数, 即key按升序的排名(从0起); 须处于排名模式
+size_t lr_tree_rank(const LR_Tree_Root *lr_tree, int key);
+// 返回按key升序的第index个(从0起)元素, index不小于元素总数时返回NULL; 须处于排名模式
+KV_Node *lr_tree_select(const LR_Tree_Root *lr_tree, size_t index);
 // 返回键值key对应的线性回归树元素, 若是无则返回NULL
 KV_Node *lr_tree_query(const LR_Tree_Root *lr_tree, int key);
+// 返回lr_tree_query得到的元素的值字符串, node为NULL时返回NULL; 下一次修改线性回归树之前有效
+const char *lr_tree_value(const LR_Tree_Root *lr_tree, const KV_Node *node);
+// 定长值模式下插入(或者更新)键值为key的元素, 从val复制payload_size字节的值
+void lr_tree_insert_pod(const LR_Tree_Root *lr_tree, int key, const void *val);
+// 定长值模式下查找key, 找到时把值复制到val并返回true
+bool lr_tree_query_pod(const LR_Tree_Root *lr_tree, int key, void *val);
 // 打印线性回归树中节点的信息
 void print_lr_tree_root(const LR_Tree_Root *lr_tree, int key);
 
@@ -0,0 +1,46 @@
+#ifndef SLAB_H_
+#define SLAB_H_
+#include <stdint.h>
+#include "utility.h"
+// ---------------------宏定义--------------------
+#define SLAB_ARENA_SIZE ((size_t)2 << 20) // 每个arena的大小, 即一个2MB大页
+#define SLAB_CLASS_MAX 16                 // 一个slab最多的尺寸类数量
+#define SLAB_CHUNK_MAX (SLAB_ARENA_SIZE / 8) // 可分配的最大块
+
+// --------------------结构体定义------------------
+// arena头部, 位于按SLAB_ARENA_SIZE对齐的arena起始处, 块的地址向下对齐即可找到所属arena
+typedef struct Slab_Arena {
+    struct Slab_Arena *next; // slab中的下一个arena
+    void *map;               // 向系统申请的整段内存, 可能比arena更大
+    size_t map_size;         // 整段内存的大小
+    int cls;                 // 该arena只切分这一尺寸类的块
+} Slab_Arena;
+
+// 一个尺寸类: 同一大小的块从空闲链表或当前arena的剩余空间中分配
+typedef struct Slab_Class {
+    size_t size;     // 块大小, 向上取整到缓存行
+    void *free_list; // 已释放的块, 每块开头存放下一块的地址
+    char *bump, *end; // 当前arena中尚未切分的空间[bump, end)
+    size_t live;      // 已分配且尚未归还的块数
+} Slab_Class;
+
+// 按尺寸类分配固定大小块的slab, 内存来自2MB对齐的大页arena, 只能整体释放arena
+typedef struct Slab {
+    Slab_Class cls[SLAB_CLASS_MAX];
+    int class_num;     // 已使用的尺寸类数量
+    Slab_Arena *arena; // 所有arena组成的链表
+    int arena_num;     // arena数量
+} Slab;
+// ---------------------函数原型-------------------
+// 创建一个空的slab, 第一次分配时才申请arena
+Slab *slab_create(void);
+// 从slab(Slab指针)中分配size字节的块, 块按缓存行对齐;
+// 尺寸类已满时回收一个块已全部归还的尺寸类及其arena, 供新的尺寸使用;
+// size超过SLAB_CHUNK_MAX, 或SLAB_CLASS_MAX个尺寸类都有未归还的块时返回NULL
+void *slab_alloc(void *slab, size_t size);
+// 把slab_alloc分配的块归还给所属尺寸类的空闲链表
+void slab_free(void *slab, void *ptr);
+// 归还slab的全部arena并释放slab本身, 代价与arena数量成正比
+void slab_destroy(Slab *slab);
+
+#endif // SLAB_H_
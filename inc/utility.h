@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,16 +16,17 @@
 #define EPSILON 1e-8             // 误差精度
 #define LEFT_EDGE (INT_MIN + 1)  // 范围左边界
 #define RIGHT_EDGE (INT_MAX - 1) // 范围右边界
+#define CACHE_LINE 64            // 缓存行大小(字节)
 
 // --------------------结构体定义------------------
-// 键值对结构体, 存储int - string关系对
+// 键值对结构体, 存储int - string关系对; 字符串存放在B树的值日志中, 这里只保存其句柄
 typedef struct KV_Node {
     int key;
-    char *str;
+    uint32_t val; // 值日志(Value_Log)中的句柄
 } KV_Node;
 
 // ---------------------函数原型-------------------
-// B树中KV_Node元素的比较规则
+// B树中KV_Node元素的比较规则, 按key升序
 int kv_node_compare(const void *a, const void *b, void *udata);
 // 产生均值为RAND_MEAN, 标准差为RAND_SIGMA的随机整数
 int gauss_rand_integer(void);
@@ -32,10 +34,13 @@ int gauss_rand_integer(void);
 void quick_sort(int *arr, int l, int r);
 // 创建服从正态分布的n个不重合的整数
 int *generate_sorted_arr(int n);
+// 以rand_integer(udata)为随机数来源, 创建n个不重合的有序整数
+int *generate_sorted_arr_by(int n, int (*rand_integer)(const void *udata),
+                            const void *udata);
 // 基于样本给出统计特征(均值和方差)
 void statistic_feature(int *arr, int n, double *avg, double *sigma);
-// 打印一个KV_Node节点中的键值对信息
-void print_kv_node(const KV_Node *node);
+// 打印一个KV_Node节点中的键值对信息, value为其值字符串
+void print_kv_node(const KV_Node *node, const char *value);
 // 计算正态分布的概率密度函数
 double normal_distribution(double mean, double sigma, double x);
 // 基于erf函数计算累积分布函数y
@@ -45,6 +50,21 @@ double normal_icdf(double mean, double sigma, double y);
 // 对[left, right]段的key值进行线性拟合
 void linear_fitting(double mean, double sigma, int left, int right, double *k,
                     double *b, int base);
+// 对有序样本keys[0, n)的(key, rank)点对进行线性拟合, rank映射到[0, base)
+void sample_linear_fitting(const int *keys, int n, double *k, double *b,
+                           int base);
+// 对有序样本的(key, 累计权重)点对进行加权最小二乘拟合, 第i个点的权重为cum[i + 1] - cum[i],
+// 纵坐标为其之前的累计权重, 并重映射到[0, base)之间
+void weighted_linear_fitting(const int *keys, const double *cum, int n,
+                             double *k, double *b, int base);
+// 分配按缓存行对齐的内存, 须用aligned_free释放
+void *aligned_malloc(size_t size);
+// 释放aligned_malloc分配的内存
+void aligned_free(void *ptr);
+// 返回当前机器可用的CPU核数, 至少为1
+int cpu_count(void);
+// 返回单调递增的墙上时间(毫秒), 用于计量多线程程序的耗时
+double wall_time_ms(void);
 // 生成n组测试数据
 char** generate_str(int n, int* arr);
 // 释放n组测试数据内存
@@ -0,0 +1,57 @@
+#ifndef VALUE_LOG_H_
+#define VALUE_LOG_H_
+#include <stdint.h>
+#include "utility.h"
+// ---------------------宏定义--------------------
+#define VALUE_LOG_SEGMENT_SIZE ((size_t)1 << 20) // 每个日志段的大小
+#define VALUE_LOG_ALIGN 8         // 记录按8字节对齐, 句柄中的段内偏移以此为单位
+#define VALUE_LOG_OFFSET_BITS 17  // 句柄低17位为段内偏移/VALUE_LOG_ALIGN, 高15位为段号
+#define VALUE_LOG_SEGMENT_MAX ((uint32_t)1 << (32 - VALUE_LOG_OFFSET_BITS)) // 最多的段数
+#define VALUE_LOG_NULL 0          // 空句柄, 每段的前VALUE_LOG_ALIGN字节不存放记录, 不会与之冲突
+// 失效字节数至少为该值且超过有效字节数时, value_log_need_compact才要求整理
+#define VALUE_LOG_COMPACT_MIN (4 * VALUE_LOG_SEGMENT_SIZE)
+
+// --------------------结构体定义------------------
+// 一个日志段: 记录只在末尾追加, 失效后只计数, 整段失效时立即归还, 否则由整理搬走其中的有效记录
+typedef struct Value_Log_Segment {
+    char *data;    // 段内存, NULL表示该段号空闲
+    uint32_t size; // 段的字节数, 单条超大记录独占的段大于VALUE_LOG_SEGMENT_SIZE
+    uint32_t used; // 已追加到的偏移
+    uint32_t dead; // 已失效记录的字节数
+    bool victim;   // 整理中, 有效记录将被搬到新段, 整理结束时归还
+} Value_Log_Segment;
+
+// 字符串值的追加日志, 以32位句柄(段号, 段内偏移)引用其中的记录;
+// 记录为4字节长度 + 以'\0'结尾的字符串, 句柄在整理之前一直有效
+typedef struct Value_Log {
+    Value_Log_Segment *seg; // 段数组, 下标即段号
+    uint32_t seg_num;       // 已使用过的段号数量
+    uint32_t seg_cap;       // seg数组的容量
+    uint32_t active;        // 当前追加的段号, UINT32_MAX表示尚无
+    size_t live, dead;      // 有效记录与失效记录的总字节数
+    size_t bytes;           // 所有段占用的内存
+} Value_Log;
+// ---------------------函数原型-------------------
+// 创建一个空的值日志, 第一次追加时才分配段
+Value_Log *value_log_create(void);
+// 释放值日志的所有段以及值日志本身
+void value_log_destroy(Value_Log *log);
+// 把字符串s追加到日志末尾, 返回其句柄; 内存不足或段号用尽时返回VALUE_LOG_NULL
+uint32_t value_log_append(Value_Log *log, const char *s);
+// 返回句柄h对应的字符串, h为VALUE_LOG_NULL时返回NULL
+const char *value_log_get(const Value_Log *log, uint32_t h);
+// 标记句柄h对应的记录失效, 所在段的记录全部失效时立即归还该段; h为VALUE_LOG_NULL时不做任何事
+void value_log_release(Value_Log *log, uint32_t h);
+// 判断失效记录是否已多到需要整理
+bool value_log_need_compact(const Value_Log *log);
+// 开始整理: 把失效字节不少于一半的段标记为待整理, 之后的追加写入新段, 返回待整理的段数;
+// 调用者随后须对每个仍被引用的句柄调用value_log_relocate, 最后调用value_log_compact_end
+int value_log_compact_begin(Value_Log *log);
+// 若句柄h位于待整理的段, 把记录复制到新段并返回新句柄, 否则原样返回h
+uint32_t value_log_relocate(Value_Log *log, uint32_t h);
+// 结束整理, 归还所有待整理的段
+void value_log_compact_end(Value_Log *log);
+// 返回值日志占用的内存字节数
+size_t value_log_memory(const Value_Log *log);
+
+#endif // VALUE_LOG_H_
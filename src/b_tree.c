@@ -5,6 +5,9 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #ifndef B_Tree_STATIC
 #include "../inc/b_tree.h"
@@ -71,6 +74,7 @@ struct B_Tree_node {
     bool leaf;
     size_t nitems:16;
     char *items;
+    int *keys;      // kv_int trees only: copy of the item keys, else NULL
     struct B_Tree_node *children[];
 };
 
@@ -78,6 +82,9 @@ struct B_Tree {
     void *(*malloc)(size_t);
     void *(*realloc)(void *, size_t);
     void (*free)(void *);
+    void *(*node_alloc)(void *udata, size_t size); // optional, for nodes only
+    void (*node_release)(void *udata, void *ptr);
+    void *node_udata;
     int (*compare)(const void *a, const void *b, void *udata);
     int (*searcher)(const void *items, size_t nitems, const void *key,
         bool *found, void *udata);
@@ -91,6 +98,8 @@ struct B_Tree {
     size_t min_items;        // min items allowed per node before needing join
     size_t elsize;           // size of user item
     bool oom;                // last write operation failed due to no memory
+    bool kv_int;             // items start with an int key they are ordered by
+    bool ranked;             // branch nodes count the items under each child
     size_t spare_elsize;     // size of each spare element. This is aligned
     char spare_data[];       // spare element spaces for various operations
 };
@@ -113,31 +122,120 @@ void B_Tree_set_searcher(struct B_Tree *B_Tree,
 #define B_Tree_SPARE_POPMAX B_Tree_spare_at(B_Tree, 2) // B_Tree_delete popmax
 #define B_Tree_SPARE_CLONE  B_Tree_spare_at(B_Tree, 3) // cloned inputs 
 
+// Trees created by b_tree_create hold KV_Node items ordered by their int key
+// (kv_int); trees created by b_tree_create_pod hold an int key followed by a
+// fixed-size payload, which is kv_int as well. For those trees the hot paths
+// below are instantiated a second time with the key comparison inlined in
+// place of the compare function pointer, and KV_Node items are copied with a
+// compile-time size. Passing a constant kv argument to the B_Tree_INLINE
+// functions selects the instance.
+//
+// Their nodes also keep the keys of the items in a separate contiguous int
+// array, kept in step with items by the helpers below, so that the node
+// search scans packed keys with SIMD compares instead of striding over the
+// items. B_Tree_KEY_PAD extra slots let the scan read a full window past the
+// last item.
+#define B_Tree_KEY_WINDOW 16
+#define B_Tree_KEY_PAD    B_Tree_KEY_WINDOW
+#if defined(__GNUC__)
+#define B_Tree_INLINE static inline __attribute__((always_inline))
+#else
+#define B_Tree_INLINE static inline
+#endif
+
+B_Tree_INLINE void *B_Tree_item_at(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node, size_t index, bool kv)
+{
+    if (kv && B_Tree->elsize == sizeof(struct KV_Node)) {
+        return (struct KV_Node*)node->items + index;
+    }
+    return node->items+B_Tree->elsize*index;
+}
+
+B_Tree_INLINE void B_Tree_item_copy(const struct B_Tree *B_Tree, void *dst,
+    const void *src)
+{
+    if (B_Tree->kv_int && B_Tree->elsize == sizeof(struct KV_Node)) {
+        *(struct KV_Node*)dst = *(const struct KV_Node*)src;
+    } else if (B_Tree->kv_int) {
+        // key plus payload, a whole number of ints
+        for (size_t i = 0; i < B_Tree->elsize/sizeof(int); i++) {
+            ((int*)dst)[i] = ((const int*)src)[i];
+        }
+    } else {
+        memcpy(dst, src, B_Tree->elsize);
+    }
+}
+
 static void *B_Tree_get_item_at(struct B_Tree *B_Tree, struct B_Tree_node *node, 
     size_t index)
 {
-    return node->items+B_Tree->elsize*index;
+    return B_Tree_item_at(B_Tree, node, index, B_Tree->kv_int);
+}
+
+B_Tree_INLINE void B_Tree_key_sync(struct B_Tree *B_Tree,
+    struct B_Tree_node *node, size_t index)
+{
+    if (node->keys) {
+        node->keys[index] = *(int*)B_Tree_get_item_at(B_Tree, node, index);
+    }
 }
 
 static void B_Tree_set_item_at(struct B_Tree *B_Tree, struct B_Tree_node *node,
     size_t index, const void *item) 
 {
     void *slot = B_Tree_get_item_at(B_Tree, node, index);
-    memcpy(slot, item, B_Tree->elsize);
+    B_Tree_item_copy(B_Tree, slot, item);
+    B_Tree_key_sync(B_Tree, node, index);
 }
 
 static void B_Tree_swap_item_at(struct B_Tree *B_Tree, struct B_Tree_node *node,
     size_t index, const void *item, void *into)
 { 
     void *ptr = B_Tree_get_item_at(B_Tree, node, index);
-    memcpy(into, ptr, B_Tree->elsize);
-    memcpy(ptr, item, B_Tree->elsize);
+    B_Tree_item_copy(B_Tree, into, ptr);
+    B_Tree_item_copy(B_Tree, ptr, item);
+    B_Tree_key_sync(B_Tree, node, index);
 }
 
 static void B_Tree_copy_item_into(struct B_Tree *B_Tree, 
     struct B_Tree_node *node, size_t index, void *into)
 { 
-    memcpy(into, B_Tree_get_item_at(B_Tree, node, index), B_Tree->elsize);
+    B_Tree_item_copy(B_Tree, into, B_Tree_get_item_at(B_Tree, node, index));
+}
+
+// Order-statistic trees (B_Tree_set_ranked) keep, in every branch node, the
+// number of items in the subtree under each child, stored right after the
+// children array. The counts move along with the children in the node
+// helpers below, and let B_Tree_rank and B_Tree_select find an item by its
+// position in a single descent.
+static size_t *B_Tree_counts(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node)
+{
+    return (size_t*)&node->children[B_Tree->max_items+1];
+}
+
+static size_t B_Tree_subtree_count(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node)
+{
+    size_t count = node->nitems;
+    if (!node->leaf) {
+        size_t *counts = B_Tree_counts(B_Tree, node);
+        for (size_t i = 0; i <= node->nitems; i++) {
+            count += counts[i];
+        }
+    }
+    return count;
+}
+
+// Recomputes the count of child i of a branch node of a ranked tree.
+static void B_Tree_recount(struct B_Tree *B_Tree, struct B_Tree_node *node,
+    size_t i)
+{
+    if (B_Tree->ranked) {
+        B_Tree_counts(B_Tree, node)[i] =
+            B_Tree_subtree_count(B_Tree, node->children[i]);
+    }
 }
 
 static void B_Tree_node_shift_right(struct B_Tree *B_Tree, struct B_Tree_node *node,
@@ -146,9 +244,18 @@ static void B_Tree_node_shift_right(struct B_Tree *B_Tree, struct B_Tree_node *n
     size_t num_items_to_shift = node->nitems - index;
     memmove(node->items+B_Tree->elsize*(index+1), 
         node->items+B_Tree->elsize*index, num_items_to_shift*B_Tree->elsize);
+    if (node->keys) {
+        memmove(&node->keys[index+1], &node->keys[index],
+            num_items_to_shift*sizeof(int));
+    }
     if (!node->leaf) {
         memmove(&node->children[index+1], &node->children[index],
             (num_items_to_shift+1)*sizeof(struct B_Tree_node*));
+        if (B_Tree->ranked) {
+            size_t *counts = B_Tree_counts(B_Tree, node);
+            memmove(&counts[index+1], &counts[index],
+                (num_items_to_shift+1)*sizeof(size_t));
+        }
     }
     node->nitems++;
 }
@@ -159,6 +266,10 @@ static void B_Tree_node_shift_left(struct B_Tree *B_Tree, struct B_Tree_node *no
     size_t num_items_to_shift = node->nitems - index - 1;
     memmove(node->items+B_Tree->elsize*index, 
         node->items+B_Tree->elsize*(index+1), num_items_to_shift*B_Tree->elsize);
+    if (node->keys) {
+        memmove(&node->keys[index], &node->keys[index+1],
+            num_items_to_shift*sizeof(int));
+    }
     if (!node->leaf) {
         if (for_merge) {
             index++;
@@ -166,6 +277,11 @@ static void B_Tree_node_shift_left(struct B_Tree *B_Tree, struct B_Tree_node *no
         }
         memmove(&node->children[index], &node->children[index+1],
             (num_items_to_shift+1)*sizeof(struct B_Tree_node*));
+        if (B_Tree->ranked) {
+            size_t *counts = B_Tree_counts(B_Tree, node);
+            memmove(&counts[index], &counts[index+1],
+                (num_items_to_shift+1)*sizeof(size_t));
+        }
     }
     node->nitems--;
 }
@@ -173,8 +289,9 @@ static void B_Tree_node_shift_left(struct B_Tree *B_Tree, struct B_Tree_node *no
 static void B_Tree_copy_item(struct B_Tree *B_Tree, struct B_Tree_node *node_a,
     size_t index_a, struct B_Tree_node *node_b, size_t index_b) 
 {
-    memcpy(B_Tree_get_item_at(B_Tree, node_a, index_a), 
-        B_Tree_get_item_at(B_Tree, node_b, index_b), B_Tree->elsize);
+    B_Tree_item_copy(B_Tree, B_Tree_get_item_at(B_Tree, node_a, index_a), 
+        B_Tree_get_item_at(B_Tree, node_b, index_b));
+    B_Tree_key_sync(B_Tree, node_a, index_a);
 }
 
 static void B_Tree_node_join(struct B_Tree *B_Tree, struct B_Tree_node *left,
@@ -182,9 +299,18 @@ static void B_Tree_node_join(struct B_Tree *B_Tree, struct B_Tree_node *left,
 {
     memcpy(left->items+B_Tree->elsize*left->nitems, right->items,
         right->nitems*B_Tree->elsize);
+    if (left->keys) {
+        memcpy(&left->keys[left->nitems], right->keys,
+            right->nitems*sizeof(int));
+    }
     if (!left->leaf) {
         memcpy(&left->children[left->nitems], &right->children[0],
             (right->nitems+1)*sizeof(struct B_Tree_node*));
+        if (B_Tree->ranked) {
+            memcpy(&B_Tree_counts(B_Tree, left)[left->nitems],
+                B_Tree_counts(B_Tree, right),
+                (right->nitems+1)*sizeof(size_t));
+        }
     }
     left->nitems += right->nitems;
 }
@@ -195,15 +321,88 @@ static int _B_Tree_compare(const struct B_Tree *B_Tree, const void *a,
     return B_Tree->compare(a, b, B_Tree->udata);
 }
 
-static size_t B_Tree_node_bsearch(const struct B_Tree *B_Tree,
-    struct B_Tree_node *node, const void *key, bool *found) 
+B_Tree_INLINE int B_Tree_cmp(const struct B_Tree *B_Tree, const void *a,
+    const void *b, bool kv)
+{
+    if (kv) {
+        int ka = ((const struct KV_Node*)a)->key;
+        int kb = ((const struct KV_Node*)b)->key;
+        return (ka > kb) - (ka < kb);
+    }
+    return _B_Tree_compare(B_Tree, a, b);
+}
+
+// Returns the number of keys[0, len) that are less than k, for len up to
+// B_Tree_KEY_WINDOW. Always reads a whole window; lanes past len are masked.
+B_Tree_INLINE size_t B_Tree_keys_count_less(const int *keys, size_t len,
+    int k)
+{
+#if defined(__AVX2__)
+    __m256i kk = _mm256_set1_epi32(k);
+    __m256i lim = _mm256_set1_epi32((int)len);
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i a = _mm256_loadu_si256((const __m256i*)keys);
+    __m256i b = _mm256_loadu_si256((const __m256i*)(keys+8));
+    a = _mm256_and_si256(_mm256_cmpgt_epi32(kk, a),
+        _mm256_cmpgt_epi32(lim, idx));
+    b = _mm256_and_si256(_mm256_cmpgt_epi32(kk, b),
+        _mm256_cmpgt_epi32(lim, _mm256_add_epi32(idx, _mm256_set1_epi32(8))));
+    unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(a)) |
+        (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(b)) << 8;
+    return (size_t)__builtin_popcount(mask);
+#elif defined(__SSE2__)
+    __m128i kk = _mm_set1_epi32(k);
+    __m128i lim = _mm_set1_epi32((int)len);
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+    unsigned mask = 0;
+    for (int i = 0; i < B_Tree_KEY_WINDOW; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(keys+i));
+        v = _mm_and_si128(_mm_cmpgt_epi32(kk, v), _mm_cmpgt_epi32(lim, idx));
+        mask |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(v)) << i;
+        idx = _mm_add_epi32(idx, _mm_set1_epi32(4));
+    }
+    return (size_t)__builtin_popcount(mask);
+#else
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) {
+        count += keys[i] < k;
+    }
+    return count;
+#endif
+}
+
+// Returns the index of the first key in [low, high) that is not less than k,
+// or high if there is none. Halves the range without branches until it fits
+// one window, then counts the smaller keys of the window.
+B_Tree_INLINE size_t B_Tree_keys_lower_bound(const int *keys, size_t low,
+    size_t high, int k)
+{
+    const int *base = keys + low;
+    size_t len = high - low;
+    while (len > B_Tree_KEY_WINDOW) {
+        size_t half = len >> 1;
+        base = base[half-1] < k ? base + half : base;
+        len -= half;
+    }
+    return (size_t)(base - keys) + B_Tree_keys_count_less(base, len, k);
+}
+
+B_Tree_INLINE size_t B_Tree_node_bsearch(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node, const void *key, bool *found, bool kv) 
 {
+    if (kv) {
+        size_t i = B_Tree_keys_lower_bound(node->keys, 0, node->nitems,
+            ((const struct KV_Node*)key)->key);
+        *found = i < node->nitems && node->keys[i] ==
+            ((const struct KV_Node*)key)->key;
+        return i;
+    }
     size_t i = 0;
     size_t n = node->nitems;
     while ( i < n ) {
         size_t j = (i + n) >> 1;
-        void *item = B_Tree_get_item_at((void*)B_Tree, node, j);
-        int cmp = _B_Tree_compare(B_Tree, key, item);
+        void *item = B_Tree_item_at(B_Tree, node, j, kv);
+        int cmp = B_Tree_cmp(B_Tree, key, item, kv);
         if (cmp == 0) {
             *found = true;
             return j;
@@ -217,20 +416,26 @@ static size_t B_Tree_node_bsearch(const struct B_Tree *B_Tree,
     return i;
 }
 
-static int B_Tree_node_bsearch_hint(const struct B_Tree *B_Tree,
+// The per-depth hint keeps one index byte for each of the first
+// B_Tree_HINT_DEPTHS levels. The top byte is left alone, since its high bit
+// is B_Tree_HINT_POS and an index of 128 or more stored there would turn the
+// hint into a relative position.
+#define B_Tree_HINT_DEPTHS 7
+
+B_Tree_INLINE int B_Tree_node_bsearch_hint(const struct B_Tree *B_Tree,
     struct B_Tree_node *node, const void *key, bool *found, uint64_t *hint,
-    int depth) 
+    int depth, bool kv) 
 {
     int low = 0;
     int high = node->nitems-1;
-    if (hint && depth < 8) {
+    if (hint && depth < B_Tree_HINT_DEPTHS) {
         size_t index = (size_t)((uint8_t*)hint)[depth];
         if (index > 0) {
             if (index > (size_t)(node->nitems-1)) {
                 index = node->nitems-1;
             }
-            void *item = B_Tree_get_item_at((void*)B_Tree, node, (size_t)index);
-            int cmp = _B_Tree_compare(B_Tree, key, item);
+            void *item = B_Tree_item_at(B_Tree, node, (size_t)index, kv);
+            int cmp = B_Tree_cmp(B_Tree, key, item, kv);
             if (cmp == 0) {
                 *found = true;
                 return index;
@@ -245,8 +450,8 @@ static int B_Tree_node_bsearch_hint(const struct B_Tree *B_Tree,
     int index;
     while ( low <= high ) {
         int mid = (low + high) / 2;
-        void *item = B_Tree_get_item_at((void*)B_Tree, node, (size_t)mid);
-        int cmp = _B_Tree_compare(B_Tree, key, item);
+        void *item = B_Tree_item_at(B_Tree, node, (size_t)mid, kv);
+        int cmp = B_Tree_cmp(B_Tree, key, item, kv);
         if (cmp == 0) {
             *found = true;
             index = mid;
@@ -261,12 +466,119 @@ static int B_Tree_node_bsearch_hint(const struct B_Tree *B_Tree,
     *found = false;
     index = low;
 done:
-    if (hint && depth < 8) {
+    if (hint && depth < B_Tree_HINT_DEPTHS) {
         ((uint8_t*)hint)[depth] = (uint8_t)index;
     }
     return index;
 }
 
+// Returns the index of the first item in [low, high) that is not less than
+// key, or high if there is none.
+B_Tree_INLINE size_t B_Tree_node_bsearch_range(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node, const void *key, bool *found, size_t low,
+    size_t high, bool kv)
+{
+    if (kv) {
+        int k = ((const struct KV_Node*)key)->key;
+        low = B_Tree_keys_lower_bound(node->keys, low, high, k);
+        *found = low < high && node->keys[low] == k;
+        return low;
+    }
+    while (low < high) {
+        size_t mid = (low + high) >> 1;
+        void *item = B_Tree_item_at(B_Tree, node, mid, kv);
+        int cmp = B_Tree_cmp(B_Tree, key, item, kv);
+        if (cmp == 0) {
+            *found = true;
+            return mid;
+        }
+        if (cmp < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    *found = false;
+    return low;
+}
+
+B_Tree_EXTERN
+uint64_t B_Tree_pos_hint(double pos) {
+    if (!(pos > 0.0)) pos = 0.0;
+    if (pos >= 1.0) pos = 1.0 - 1.0 / 4294967296.0;
+    return B_Tree_HINT_POS | (uint64_t)(pos * 4294967296.0);
+}
+
+B_Tree_INLINE size_t B_Tree_node_search_pos(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node, const void *key, bool *found, uint64_t *hint,
+    bool kv)
+{
+    size_t n = node->nitems;
+    if (n == 0) {
+        *found = false;
+        return 0;
+    }
+    double target = (double)(uint32_t)*hint / 4294967296.0 * (double)(n + 1);
+    size_t probe = (size_t)target;
+    if (probe >= n) probe = n - 1;
+    size_t index;
+    if (kv) {
+        // count inside the window around the probe when it brackets the key,
+        // otherwise search the side of the node the key falls on
+        int k = ((const struct KV_Node*)key)->key;
+        const int *keys = node->keys;
+        size_t low = probe > B_Tree_KEY_WINDOW/2 ? probe - B_Tree_KEY_WINDOW/2 : 0;
+        size_t high = low + B_Tree_KEY_WINDOW < n ? low + B_Tree_KEY_WINDOW : n;
+        if (low > 0 && keys[low-1] >= k) {
+            index = B_Tree_keys_lower_bound(keys, 0, low, k);
+        } else if (high < n && keys[high-1] < k) {
+            index = B_Tree_keys_lower_bound(keys, high, n, k);
+        } else {
+            index = low + B_Tree_keys_count_less(keys + low, high - low, k);
+        }
+        *found = index < n && keys[index] == k;
+        goto done;
+    }
+    void *item = B_Tree_item_at(B_Tree, node, probe, kv);
+    int cmp = B_Tree_cmp(B_Tree, key, item, kv);
+    if (cmp == 0) {
+        *found = true;
+        index = probe;
+        goto done;
+    }
+    // gallop away from the probe until the key is bracketed by [low, high)
+    size_t low = 0, high = probe + 1, step = 1;
+    if (cmp > 0) {
+        low = probe + 1;
+        high = n;
+        while (probe + step < n) {
+            item = B_Tree_item_at(B_Tree, node, probe + step, kv);
+            if (B_Tree_cmp(B_Tree, key, item, kv) <= 0) {
+                high = probe + step + 1;
+                break;
+            }
+            low = probe + step + 1;
+            step <<= 1;
+        }
+    } else {
+        while (step <= probe) {
+            item = B_Tree_item_at(B_Tree, node, probe - step, kv);
+            if (B_Tree_cmp(B_Tree, key, item, kv) > 0) {
+                low = probe - step + 1;
+                break;
+            }
+            high = probe - step + 1;
+            step <<= 1;
+        }
+    }
+    index = B_Tree_node_bsearch_range(B_Tree, node, key, found, low, high, kv);
+done:
+    // position of the key inside the chosen child, assuming the items of
+    // this node are spread evenly over the keys below it
+    *hint = B_Tree_pos_hint(target - (double)index);
+    return index;
+}
+
 static size_t B_Tree_memsize(size_t elsize, size_t *spare_elsize) {
     size_t size = B_Tree_align_size(sizeof(struct B_Tree));
     size_t elsize_aligned = B_Tree_align_size(elsize);
@@ -329,23 +641,62 @@ static size_t B_Tree_node_size(struct B_Tree *B_Tree, bool leaf,
     if (!leaf) {
         // add children as flexible array
         size += sizeof(struct B_Tree_node*)*(B_Tree->max_items+1);
+        if (B_Tree->ranked) {
+            size += sizeof(size_t)*(B_Tree->max_items+1);
+        }
     }
     if (items_offset) *items_offset = size;
     size += B_Tree->elsize*B_Tree->max_items;
+    if (B_Tree->kv_int) {
+        size += sizeof(int)*(B_Tree->max_items+B_Tree_KEY_PAD);
+    }
     size = B_Tree_align_size(size);
     return size;
 }
 
+static void *B_Tree_node_alloc(struct B_Tree *B_Tree, size_t size) {
+    if (B_Tree->node_alloc) {
+        return B_Tree->node_alloc(B_Tree->node_udata, size);
+    }
+    return B_Tree->malloc(size);
+}
+
+static void B_Tree_node_dealloc(struct B_Tree *B_Tree, void *node) {
+    if (B_Tree->node_release) {
+        B_Tree->node_release(B_Tree->node_udata, node);
+    } else {
+        B_Tree->free(node);
+    }
+}
+
+B_Tree_EXTERN
+void B_Tree_set_ranked(struct B_Tree *B_Tree, bool ranked) {
+    B_Tree->ranked = ranked;
+}
+
+B_Tree_EXTERN
+void B_Tree_set_node_allocator(struct B_Tree *B_Tree,
+    void *(*alloc)(void *udata, size_t size),
+    void (*release)(void *udata, void *ptr), void *udata)
+{
+    B_Tree->node_alloc = alloc;
+    B_Tree->node_release = release;
+    B_Tree->node_udata = udata;
+}
+
 static struct B_Tree_node *B_Tree_node_new(struct B_Tree *B_Tree, bool leaf) {
     size_t items_offset;
     size_t size = B_Tree_node_size(B_Tree, leaf, &items_offset);
-    struct B_Tree_node *node = B_Tree->malloc(size);
+    struct B_Tree_node *node = B_Tree_node_alloc(B_Tree, size);
     if (!node) {
         return NULL;
     }
     memset(node, 0, size);
     node->leaf = leaf;
     node->items = (char*)node+items_offset;
+    if (B_Tree->kv_int) {
+        node->keys = (int*)(node->items+B_Tree->elsize*B_Tree->max_items);
+    }
     return node;
 }
 
@@ -364,7 +715,7 @@ static void B_Tree_node_free(struct B_Tree *B_Tree, struct B_Tree_node *node) {
             B_Tree->item_free(item, B_Tree->udata);
         }
     }
-    B_Tree->free(node);
+    B_Tree_node_dealloc(B_Tree, node);
 }
 
 static struct B_Tree_node *B_Tree_node_copy(struct B_Tree *B_Tree,
@@ -381,6 +732,10 @@ static struct B_Tree_node *B_Tree_node_copy(struct B_Tree *B_Tree,
             node2->children[i] = node->children[i];
             B_Tree_rc_fetch_add(&node2->children[i]->rc, 1);
         }
+        if (B_Tree->ranked) {
+            memcpy(B_Tree_counts(B_Tree, node2), B_Tree_counts(B_Tree, node),
+                (node2->nitems+1)*sizeof(size_t));
+        }
     }
     if (B_Tree->item_clone) {
         for (size_t i = 0; i < node2->nitems; i++) {
@@ -410,7 +765,7 @@ failed:
             B_Tree->item_free(item, B_Tree->udata);
         }
     }
-    B_Tree->free(node2);
+    B_Tree_node_dealloc(B_Tree, node2);
     return NULL;
 }
 
@@ -464,17 +819,30 @@ struct B_Tree *B_Tree_clone(struct B_Tree *B_Tree) {
     return B_Tree2;
 }
 
-static size_t B_Tree_search(const struct B_Tree *B_Tree, struct B_Tree_node *node,
-    const void *key, bool *found, uint64_t *hint, int depth) 
+B_Tree_INLINE size_t B_Tree_search_kv(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node, const void *key, bool *found, uint64_t *hint,
+    int depth, bool kv) 
 {
     if (!hint && !B_Tree->searcher) {
-        return B_Tree_node_bsearch(B_Tree, node, key, found);
+        return B_Tree_node_bsearch(B_Tree, node, key, found, kv);
     }
     if (B_Tree->searcher) {
         return B_Tree->searcher(node->items, node->nitems, key, found, 
             B_Tree->udata);
     }
-    return B_Tree_node_bsearch_hint(B_Tree, node, key, found, hint, depth);
+    if (*hint & B_Tree_HINT_POS) {
+        return B_Tree_node_search_pos(B_Tree, node, key, found, hint, kv);
+    }
+    return B_Tree_node_bsearch_hint(B_Tree, node, key, found, hint, depth, kv);
+}
+
+static size_t B_Tree_search(const struct B_Tree *B_Tree, struct B_Tree_node *node,
+    const void *key, bool *found, uint64_t *hint, int depth) 
+{
+    if (B_Tree->kv_int) {
+        return B_Tree_search_kv(B_Tree, node, key, found, hint, depth, true);
+    }
+    return B_Tree_search_kv(B_Tree, node, key, found, hint, depth, false);
 }
 
 enum B_Tree_mut_result { 
@@ -499,20 +867,37 @@ static void B_Tree_node_split(struct B_Tree *B_Tree, struct B_Tree_node *node,
     (*right)->nitems = node->nitems-(mid+1);
     memmove((*right)->items, node->items+B_Tree->elsize*(mid+1),
         (*right)->nitems*B_Tree->elsize);
+    if (node->keys) {
+        memmove((*right)->keys, node->keys+mid+1,
+            (*right)->nitems*sizeof(int));
+    }
     if (!node->leaf) {
         for (size_t i = 0; i <= (*right)->nitems; i++) {
             (*right)->children[i] = node->children[mid+1+i];
         }
+        if (B_Tree->ranked) {
+            memcpy(B_Tree_counts(B_Tree, *right),
+                B_Tree_counts(B_Tree, node)+mid+1,
+                ((*right)->nitems+1)*sizeof(size_t));
+        }
     }
     node->nitems = mid;
 }
 
+// When slot is not NULL an existing item is kept rather than replaced, which
+// is reported as B_Tree_NOCHANGE, and *slot is pointed at the item stored
+// under the key, existing or inserted.
 static enum B_Tree_mut_result B_Tree_node_set(struct B_Tree *B_Tree,
-    struct B_Tree_node *node, const void *item, uint64_t *hint, int depth) 
+    struct B_Tree_node *node, const void *item, uint64_t *hint, int depth,
+    void **slot) 
 {
     bool found = false;
     size_t i = B_Tree_search(B_Tree, node, item, &found, hint, depth);
     if (found) {
+        if (slot) {
+            *slot = B_Tree_get_item_at(B_Tree, node, i);
+            return B_Tree_NOCHANGE;
+        }
         B_Tree_swap_item_at(B_Tree, node, i, item, B_Tree_SPARE_RETURN);
         return B_Tree_REPLACED;
     }
@@ -522,12 +907,17 @@ static enum B_Tree_mut_result B_Tree_node_set(struct B_Tree *B_Tree,
         }
         B_Tree_node_shift_right(B_Tree, node, i);
         B_Tree_set_item_at(B_Tree, node, i, item);
+        if (slot) *slot = B_Tree_get_item_at(B_Tree, node, i);
         return B_Tree_INSERTED;
     }
     B_Tree_cow_node_or(node->children[i], return B_Tree_NOMEM);
     enum B_Tree_mut_result result = B_Tree_node_set(B_Tree, node->children[i],
-        item, hint, depth+1);
-    if (result == B_Tree_INSERTED || result == B_Tree_REPLACED) {
+        item, hint, depth+1, slot);
+    if (result == B_Tree_INSERTED && B_Tree->ranked) {
+        B_Tree_counts(B_Tree, node)[i]++;
+    }
+    if (result == B_Tree_INSERTED || result == B_Tree_REPLACED ||
+        result == B_Tree_NOCHANGE) {
         return result;
     } else if (result == B_Tree_NOMEM) {
         return B_Tree_NOMEM;
@@ -545,11 +935,15 @@ static enum B_Tree_mut_result B_Tree_node_set(struct B_Tree *B_Tree,
     B_Tree_node_shift_right(B_Tree, node, i);
     B_Tree_set_item_at(B_Tree, node, i, median);
     node->children[i+1] = right;
-    return B_Tree_node_set(B_Tree, node, item, hint, depth);
+    B_Tree_recount(B_Tree, node, i);
+    B_Tree_recount(B_Tree, node, i+1);
+    return B_Tree_node_set(B_Tree, node, item, hint, depth, slot);
 }
 
+// See B_Tree_node_set for slot. In that mode the item is reported through
+// *slot and NULL is returned, also when an existing item was kept.
 static void *B_Tree_set0(struct B_Tree *B_Tree, const void *item, uint64_t *hint,
-    bool no_item_clone)
+    bool no_item_clone, void **slot)
 {
     B_Tree->oom = false;
     bool item_cloned = false;
@@ -569,13 +963,19 @@ static void *B_Tree_set0(struct B_Tree *B_Tree, const void *item, uint64_t *hint
         B_Tree->root->nitems = 1;
         B_Tree->count++;
         B_Tree->height++;
+        if (slot) *slot = B_Tree_get_item_at(B_Tree, B_Tree->root, 0);
         return NULL;
     }
     B_Tree_cow_node_or(B_Tree->root, goto oom);
     enum B_Tree_mut_result result;
 set:
-    result = B_Tree_node_set(B_Tree, B_Tree->root, item, hint, 0);
-    if (result == B_Tree_REPLACED) {
+    result = B_Tree_node_set(B_Tree, B_Tree->root, item, hint, 0, slot);
+    if (result == B_Tree_NOCHANGE) {
+        if (B_Tree->item_free && item_cloned) {
+            B_Tree->item_free(B_Tree_SPARE_CLONE, B_Tree->udata);
+        }
+        return NULL;
+    } else if (result == B_Tree_REPLACED) {
         if (B_Tree->item_free) {
             B_Tree->item_free(B_Tree_SPARE_RETURN, B_Tree->udata);
         }
@@ -595,7 +995,7 @@ set:
     void *median = NULL;
     B_Tree_node_split(B_Tree, old_root, &right, &median);
     if (!right) {
-        B_Tree->free(new_root);
+        B_Tree_node_dealloc(B_Tree, new_root);
         goto oom;
     }
     B_Tree->root = new_root;
@@ -603,6 +1003,8 @@ set:
     B_Tree_set_item_at(B_Tree, B_Tree->root, 0, median);
     B_Tree->root->children[1] = right;
     B_Tree->root->nitems = 1;
+    B_Tree_recount(B_Tree, B_Tree->root, 0);
+    B_Tree_recount(B_Tree, B_Tree->root, 1);
     B_Tree->height++;
     goto set;
 oom:
@@ -615,10 +1017,10 @@ oom:
     return NULL;
 }
 
-static const void *B_Tree_get0(const struct B_Tree *B_Tree, const void *key, 
-    uint64_t *hint)
+// Looks up key in the subtree at node, which need not be B_Tree->root.
+static const void *B_Tree_get_from(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node, const void *key, uint64_t *hint)
 {
-    struct B_Tree_node *node = B_Tree->root;
     if (!node) {
         return NULL;
     }
@@ -637,6 +1039,12 @@ static const void *B_Tree_get0(const struct B_Tree *B_Tree, const void *key,
     }
 }
 
+static const void *B_Tree_get0(const struct B_Tree *B_Tree, const void *key, 
+    uint64_t *hint)
+{
+    return B_Tree_get_from(B_Tree, B_Tree->root, key, hint);
+}
+
 static void B_Tree_node_rebalance(struct B_Tree *B_Tree, struct B_Tree_node *node,
     size_t i)
 {
@@ -660,8 +1068,10 @@ static void B_Tree_node_rebalance(struct B_Tree *B_Tree, struct B_Tree_node *nod
         B_Tree_copy_item(B_Tree, left, left->nitems, node, i);
         left->nitems++;
         B_Tree_node_join(B_Tree, left, right);
-        B_Tree->free(right);
+        B_Tree_node_dealloc(B_Tree, right);
         B_Tree_node_shift_left(B_Tree, node, i, true);
+        B_Tree_recount(B_Tree, node, i);
+        return;
     } else if (left->nitems > right->nitems) {
         // move left -> right over one slot
 
@@ -672,6 +1082,10 @@ static void B_Tree_node_rebalance(struct B_Tree *B_Tree, struct B_Tree_node *nod
         B_Tree_copy_item(B_Tree, right, 0, node, i);
         if (!left->leaf) {
             right->children[0] = left->children[left->nitems];
+            if (B_Tree->ranked) {
+                B_Tree_counts(B_Tree, right)[0] =
+                    B_Tree_counts(B_Tree, left)[left->nitems];
+            }
         }
         B_Tree_copy_item(B_Tree, node, i, left, left->nitems-1);
         if (!left->leaf) {
@@ -685,11 +1099,17 @@ static void B_Tree_node_rebalance(struct B_Tree *B_Tree, struct B_Tree_node *nod
         B_Tree_copy_item(B_Tree, left, left->nitems, node, i);
         if (!left->leaf) {
             left->children[left->nitems+1] = right->children[0];
+            if (B_Tree->ranked) {
+                B_Tree_counts(B_Tree, left)[left->nitems+1] =
+                    B_Tree_counts(B_Tree, right)[0];
+            }
         }
         left->nitems++;
         B_Tree_copy_item(B_Tree, node, i, right, 0);
         B_Tree_node_shift_left(B_Tree, right, 0, false);
     }
+    B_Tree_recount(B_Tree, node, i);
+    B_Tree_recount(B_Tree, node, i+1);
 }
 
 static enum B_Tree_mut_result B_Tree_node_delete(struct B_Tree *B_Tree,
@@ -767,6 +1187,9 @@ static enum B_Tree_mut_result B_Tree_node_delete(struct B_Tree *B_Tree,
     if (result != B_Tree_DELETED) {
         return result;
     }
+    if (B_Tree->ranked) {
+        B_Tree_counts(B_Tree, node)[i]--;
+    }
     if (node->children[i]->nitems < B_Tree->min_items) {
         B_Tree_node_rebalance(B_Tree, node, i);
     }
@@ -795,7 +1218,7 @@ static void *B_Tree_delete0(struct B_Tree *B_Tree, enum B_Tree_delact act,
         } else {
             B_Tree->root = NULL;
         }
-        B_Tree->free(old_root);
+        B_Tree_node_dealloc(B_Tree, old_root);
         B_Tree->height--;
     }
     B_Tree->count--;
@@ -812,12 +1235,50 @@ B_Tree_EXTERN
 const void *B_Tree_set_hint(struct B_Tree *B_Tree, const void *item, 
     uint64_t *hint)
 {
-    return B_Tree_set0(B_Tree, item, hint, false);
+    return B_Tree_set0(B_Tree, item, hint, false, NULL);
 }
 
 B_Tree_EXTERN
 const void *B_Tree_set(struct B_Tree *B_Tree, const void *item) {
-    return B_Tree_set0(B_Tree, item, NULL, false);
+    return B_Tree_set0(B_Tree, item, NULL, false, NULL);
+}
+
+B_Tree_EXTERN
+void *B_Tree_get_or_set(struct B_Tree *B_Tree, const void *item,
+    bool *inserted)
+{
+    void *slot = NULL;
+    size_t count = B_Tree->count;
+    B_Tree_set0(B_Tree, item, NULL, false, &slot);
+    if (inserted) *inserted = B_Tree->count != count;
+    return B_Tree->oom ? NULL : slot;
+}
+
+B_Tree_EXTERN
+void *B_Tree_get_mut(struct B_Tree *B_Tree, const void *key) {
+    B_Tree->oom = false;
+    if (!B_Tree->root) {
+        return NULL;
+    }
+    B_Tree_cow_node_or(B_Tree->root, goto oom);
+    struct B_Tree_node *node = B_Tree->root;
+    bool found;
+    int depth = 0;
+    while (1) {
+        size_t i = B_Tree_search(B_Tree, node, key, &found, NULL, depth);
+        if (found) {
+            return B_Tree_get_item_at(B_Tree, node, i);
+        }
+        if (node->leaf) {
+            return NULL;
+        }
+        B_Tree_cow_node_or(node->children[i], goto oom);
+        node = node->children[i];
+        depth++;
+    }
+oom:
+    B_Tree->oom = true;
+    return NULL;
 }
 
 B_Tree_EXTERN
@@ -844,6 +1305,20 @@ const void *B_Tree_delete(struct B_Tree *B_Tree, const void *key) {
     return B_Tree_delete0(B_Tree, B_Tree_DELKEY, 0, key, NULL);
 }
 
+// Adds delta to the counts along the leftmost or rightmost path of a ranked
+// tree, after the fast paths below add or remove an item at that end.
+static void B_Tree_edge_count(struct B_Tree *B_Tree, bool right, int delta) {
+    if (!B_Tree->ranked) {
+        return;
+    }
+    struct B_Tree_node *node = B_Tree->root;
+    while (!node->leaf) {
+        size_t i = right ? node->nitems : 0;
+        B_Tree_counts(B_Tree, node)[i] += delta;
+        node = node->children[i];
+    }
+}
+
 B_Tree_EXTERN
 const void *B_Tree_pop_min(struct B_Tree *B_Tree) {
     B_Tree->oom = false;
@@ -859,6 +1334,7 @@ const void *B_Tree_pop_min(struct B_Tree *B_Tree) {
                     if (B_Tree->item_free) {
                         B_Tree->item_free(B_Tree_SPARE_RETURN, B_Tree->udata);
                     }
+                    B_Tree_edge_count(B_Tree, false, -1);
                     B_Tree->count--;
                     return B_Tree_SPARE_RETURN;
                 }
@@ -889,6 +1365,7 @@ const void *B_Tree_pop_max(struct B_Tree *B_Tree) {
                     if (B_Tree->item_free) {
                         B_Tree->item_free(B_Tree_SPARE_RETURN, B_Tree->udata);
                     }
+                    B_Tree_edge_count(B_Tree, true, -1);
                     B_Tree->count--;
                     return B_Tree_SPARE_RETURN;
                 }
@@ -970,20 +1447,27 @@ static bool B_Tree_node_ascend(const struct B_Tree *B_Tree,
     return true;
 }
 
-B_Tree_EXTERN
-bool B_Tree_ascend_hint(const struct B_Tree *B_Tree, const void *pivot, 
+// Ascends the subtree at node, which need not be B_Tree->root.
+static bool B_Tree_ascend_from(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node, const void *pivot,
     bool (*iter)(const void *item, void *udata), void *udata, uint64_t *hint) 
 {
-    if (B_Tree->root) {
+    if (node) {
         if (!pivot) {
-            return B_Tree_node_scan(B_Tree, B_Tree->root, iter, udata);
+            return B_Tree_node_scan(B_Tree, node, iter, udata);
         }
-        return B_Tree_node_ascend(B_Tree, B_Tree->root, pivot, iter, udata, hint, 
-            0);
+        return B_Tree_node_ascend(B_Tree, node, pivot, iter, udata, hint, 0);
     }
     return true;
 }
 
+B_Tree_EXTERN
+bool B_Tree_ascend_hint(const struct B_Tree *B_Tree, const void *pivot, 
+    bool (*iter)(const void *item, void *udata), void *udata, uint64_t *hint) 
+{
+    return B_Tree_ascend_from(B_Tree, B_Tree->root, pivot, iter, udata, hint);
+}
+
 B_Tree_EXTERN
 bool B_Tree_ascend(const struct B_Tree *B_Tree, const void *pivot, 
     bool (*iter)(const void *item, void *udata), void *udata) 
@@ -1081,9 +1565,10 @@ bool B_Tree_descend(const struct B_Tree *B_Tree, const void *pivot,
     return B_Tree_descend_hint(B_Tree, pivot, iter, udata, NULL);
 }
 
-B_Tree_EXTERN
-const void *B_Tree_min(const struct B_Tree *B_Tree) {
-    struct B_Tree_node *node = B_Tree->root;
+// Returns the first item of the subtree at node, or NULL if node is NULL.
+static const void *B_Tree_min_from(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node)
+{
     if (!node) {
         return NULL;
     }
@@ -1095,9 +1580,10 @@ const void *B_Tree_min(const struct B_Tree *B_Tree) {
     }
 }
 
-B_Tree_EXTERN
-const void *B_Tree_max(const struct B_Tree *B_Tree) {
-    struct B_Tree_node *node = B_Tree->root;
+// Returns the last item of the subtree at node, or NULL if node is NULL.
+static const void *B_Tree_max_from(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node)
+{
     if (!node) {
         return NULL;
     }
@@ -1109,11 +1595,104 @@ const void *B_Tree_max(const struct B_Tree *B_Tree) {
     }
 }
 
+B_Tree_EXTERN
+const void *B_Tree_min(const struct B_Tree *B_Tree) {
+    return B_Tree_min_from(B_Tree, B_Tree->root);
+}
+
+B_Tree_EXTERN
+const void *B_Tree_max(const struct B_Tree *B_Tree) {
+    return B_Tree_max_from(B_Tree, B_Tree->root);
+}
+
+// Returns the item nearest to key in the subtree at node in one descent: the
+// first item not less than key, or with floor the last item not greater
+// than key. NULL if there is none.
+static const void *B_Tree_bound_from(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node, const void *key, bool floor)
+{
+    const void *best = NULL;
+    int depth = 0;
+    while (node) {
+        bool found;
+        size_t i = B_Tree_search(B_Tree, node, key, &found, NULL, depth);
+        if (found) {
+            return B_Tree_get_item_at((void*)B_Tree, node, i);
+        }
+        if (floor ? i > 0 : i < node->nitems) {
+            best = B_Tree_get_item_at((void*)B_Tree, node, floor ? i-1 : i);
+        }
+        node = node->leaf ? NULL : node->children[i];
+        depth++;
+    }
+    return best;
+}
+
+// Counts the items less than key in the subtree at node of a ranked tree.
+static size_t B_Tree_rank_from(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node, const void *key)
+{
+    size_t rank = 0;
+    int depth = 0;
+    while (node) {
+        bool found;
+        size_t i = B_Tree_search(B_Tree, node, key, &found, NULL, depth);
+        if (node->leaf) {
+            return rank + i;
+        }
+        // every child left of i, and the item that follows it
+        size_t *counts = B_Tree_counts(B_Tree, node);
+        for (size_t j = 0; j < i; j++) {
+            rank += counts[j] + 1;
+        }
+        if (found) {
+            return rank + counts[i];
+        }
+        node = node->children[i];
+        depth++;
+    }
+    return rank;
+}
+
+// Returns the item at zero-based position index in the subtree at node of a
+// ranked tree, or NULL if the subtree holds no more than index items.
+static const void *B_Tree_select_from(const struct B_Tree *B_Tree,
+    struct B_Tree_node *node, size_t index)
+{
+    while (node) {
+        if (node->leaf) {
+            return index < node->nitems ?
+                B_Tree_get_item_at((void*)B_Tree, node, index) : NULL;
+        }
+        size_t *counts = B_Tree_counts(B_Tree, node);
+        size_t i = 0;
+        while (i < node->nitems && index >= counts[i]) {
+            if (index == counts[i]) {
+                return B_Tree_get_item_at((void*)B_Tree, node, i);
+            }
+            index -= counts[i] + 1;
+            i++;
+        }
+        node = node->children[i];
+    }
+    return NULL;
+}
+
+B_Tree_EXTERN
+size_t B_Tree_rank(const struct B_Tree *B_Tree, const void *key) {
+    return B_Tree_rank_from(B_Tree, B_Tree->root, key);
+}
+
+B_Tree_EXTERN
+const void *B_Tree_select(const struct B_Tree *B_Tree, size_t index) {
+    return B_Tree_select_from(B_Tree, B_Tree->root, index);
+}
+
 B_Tree_EXTERN
 const void *B_Tree_load(struct B_Tree *B_Tree, const void *item) {
     B_Tree->oom = false;
     if (!B_Tree->root) {
-        return B_Tree_set0(B_Tree, item, NULL, false);
+        return B_Tree_set0(B_Tree, item, NULL, false, NULL);
     }
     bool item_cloned = false;
     if (B_Tree->item_clone) {
@@ -1132,13 +1711,14 @@ const void *B_Tree_load(struct B_Tree *B_Tree, const void *item) {
             if (_B_Tree_compare(B_Tree, item, litem) <= 0) break;
             B_Tree_set_item_at(B_Tree, node, node->nitems, item);
             node->nitems++; 
+            B_Tree_edge_count(B_Tree, true, 1);
             B_Tree->count++;
             return NULL;
         }
         B_Tree_cow_node_or(node->children[node->nitems], goto oom);
         node = node->children[node->nitems];
     }
-    const void *prev = B_Tree_set0(B_Tree, item, NULL, true);
+    const void *prev = B_Tree_set0(B_Tree, item, NULL, true, NULL);
     if (!B_Tree->oom) {
         return prev;
     }
@@ -1150,6 +1730,122 @@ oom:
     return NULL;
 }
 
+// Frees the nodes of a subtree without calling item_free, for items that
+// still belong to the caller or have been moved elsewhere. Nodes shared with
+// a clone are only dereferenced.
+static void B_Tree_node_release(struct B_Tree *B_Tree,
+    struct B_Tree_node *node)
+{
+    if (B_Tree_rc_fetch_sub(&node->rc, 1) > 0) {
+        return;
+    }
+    if (!node->leaf) {
+        for (size_t i = 0; i < (size_t)(node->nitems+1); i++) {
+            B_Tree_node_release(B_Tree, node->children[i]);
+        }
+    }
+    B_Tree_node_dealloc(B_Tree, node);
+}
+
+// Builds a subtree of the given height from count sorted items. The items
+// are split evenly among the fewest children that can hold them, cap[h]
+// being the most items a subtree of height h holds, so every node is within
+// one item of the others on its level and none falls below min_items.
+static struct B_Tree_node *B_Tree_node_build(struct B_Tree *B_Tree,
+    const char *items, size_t count, size_t height, const size_t *cap)
+{
+    struct B_Tree_node *node = B_Tree_node_new(B_Tree, height == 1);
+    if (!node) {
+        return NULL;
+    }
+    if (height == 1) {
+        memcpy(node->items, items, count*B_Tree->elsize);
+        if (node->keys) {
+            for (size_t i = 0; i < count; i++) {
+                node->keys[i] = *(const int*)(items + B_Tree->elsize*i);
+            }
+        }
+        node->nitems = count;
+        return node;
+    }
+    size_t nchild = (count + 1 + cap[height-1]) / (cap[height-1] + 1);
+    size_t share = (count - (nchild - 1)) / nchild;
+    size_t extra = (count - (nchild - 1)) % nchild;
+    for (size_t i = 0; i < nchild; i++) {
+        size_t m = share + (i < extra);
+        struct B_Tree_node *child = B_Tree_node_build(B_Tree, items, m,
+            height-1, cap);
+        if (!child) {
+            for (size_t j = 0; j < i; j++) {
+                B_Tree_node_release(B_Tree, node->children[j]);
+            }
+            B_Tree_node_dealloc(B_Tree, node);
+            return NULL;
+        }
+        node->children[i] = child;
+        if (B_Tree->ranked) {
+            B_Tree_counts(B_Tree, node)[i] = m;
+        }
+        items += m*B_Tree->elsize;
+        if (i+1 < nchild) {
+            B_Tree_set_item_at(B_Tree, node, i, items);
+            items += B_Tree->elsize;
+        }
+    }
+    node->nitems = nchild - 1;
+    return node;
+}
+
+B_Tree_EXTERN
+bool B_Tree_rebuild_sorted(struct B_Tree *B_Tree, const void *items,
+    size_t count)
+{
+    B_Tree->oom = false;
+    struct B_Tree_node *root = NULL;
+    size_t height = 0;
+    if (count > 0) {
+        size_t cap[64];
+        height = 1;
+        cap[1] = B_Tree->max_items;
+        while (cap[height] < count) {
+            size_t fan = B_Tree->max_items + 1;
+            cap[height+1] = (cap[height] + 1) > SIZE_MAX / fan ? SIZE_MAX :
+                (cap[height] + 1) * fan - 1;
+            height++;
+        }
+        root = B_Tree_node_build(B_Tree, (const char*)items, count, height,
+            cap);
+        if (!root) {
+            B_Tree->oom = true;
+            return false;
+        }
+    }
+    if (B_Tree->root) {
+        B_Tree_node_release(B_Tree, B_Tree->root);
+    }
+    B_Tree->root = root;
+    B_Tree->count = count;
+    B_Tree->height = height;
+    return true;
+}
+
+B_Tree_EXTERN
+bool B_Tree_load_sorted(struct B_Tree *B_Tree, const void *items,
+    size_t count)
+{
+    B_Tree->oom = false;
+    if (B_Tree->root || B_Tree->item_clone) {
+        for (size_t i = 0; i < count; i++) {
+            B_Tree_load(B_Tree, (const char*)items + B_Tree->elsize*i);
+            if (B_Tree->oom) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return B_Tree_rebuild_sorted(B_Tree, items, count);
+}
+
 B_Tree_EXTERN
 size_t B_Tree_height(const struct B_Tree *B_Tree) {
     return B_Tree->height;
@@ -1170,10 +1866,12 @@ struct B_Tree_iter {
     struct B_Tree_iter_stack_item stack[];
 };
 
-B_Tree_EXTERN
-struct B_Tree_iter *B_Tree_iter_new(const struct B_Tree *B_Tree) {
+// Allocates an iterator with room for a path of the given height.
+static struct B_Tree_iter *B_Tree_iter_alloc(const struct B_Tree *B_Tree,
+    size_t height)
+{
     size_t vsize = B_Tree_align_size(sizeof(struct B_Tree_iter) + 
-        sizeof(struct B_Tree_iter_stack_item) * B_Tree->height);
+        sizeof(struct B_Tree_iter_stack_item) * height);
     struct B_Tree_iter *iter = B_Tree->malloc(vsize + B_Tree->elsize);
     if (iter) {
         memset(iter, 0, vsize + B_Tree->elsize);
@@ -1183,22 +1881,30 @@ struct B_Tree_iter *B_Tree_iter_new(const struct B_Tree *B_Tree) {
     return iter;
 }
 
+B_Tree_EXTERN
+struct B_Tree_iter *B_Tree_iter_new(const struct B_Tree *B_Tree) {
+    return B_Tree_iter_alloc(B_Tree, B_Tree->height);
+}
+
 B_Tree_EXTERN
 void B_Tree_iter_free(struct B_Tree_iter *iter) {
     iter->B_Tree->free(iter);
 }
 
-B_Tree_EXTERN
-bool B_Tree_iter_first(struct B_Tree_iter *iter) {
+// The _from variants position the iterator in the subtree at root, which
+// need not be iter->B_Tree->root.
+static bool B_Tree_iter_first_from(struct B_Tree_iter *iter,
+    struct B_Tree_node *root)
+{
     iter->atend = false;
     iter->atstart = false;
     iter->seeked = false;
     iter->nstack = 0;
-    if (!iter->B_Tree->root) {
+    if (!root) {
         return false;
     }
     iter->seeked = true;
-    struct B_Tree_node *node = iter->B_Tree->root;
+    struct B_Tree_node *node = root;
     while (1) {
         iter->stack[iter->nstack++] = (struct B_Tree_iter_stack_item) {
             .node = node,
@@ -1215,16 +1921,22 @@ bool B_Tree_iter_first(struct B_Tree_iter *iter) {
 }
 
 B_Tree_EXTERN
-bool B_Tree_iter_last(struct B_Tree_iter *iter) {
+bool B_Tree_iter_first(struct B_Tree_iter *iter) {
+    return B_Tree_iter_first_from(iter, iter->B_Tree->root);
+}
+
+static bool B_Tree_iter_last_from(struct B_Tree_iter *iter,
+    struct B_Tree_node *root)
+{
     iter->atend = false;
     iter->atstart = false;
     iter->seeked = false;
     iter->nstack = 0;
-    if (!iter->B_Tree->root) {
+    if (!root) {
         return false;
     }
     iter->seeked = true;
-    struct B_Tree_node *node = iter->B_Tree->root;
+    struct B_Tree_node *node = root;
     while (1) {
         iter->stack[iter->nstack++] = (struct B_Tree_iter_stack_item) {
             .node = node,
@@ -1241,6 +1953,11 @@ bool B_Tree_iter_last(struct B_Tree_iter *iter) {
     return true;
 }
 
+B_Tree_EXTERN
+bool B_Tree_iter_last(struct B_Tree_iter *iter) {
+    return B_Tree_iter_last_from(iter, iter->B_Tree->root);
+}
+
 B_Tree_EXTERN
 bool B_Tree_iter_next(struct B_Tree_iter *iter) {
     if (!iter->seeked) {
@@ -1322,20 +2039,22 @@ bool B_Tree_iter_prev(struct B_Tree_iter *iter) {
 }
 
 
-B_Tree_EXTERN
-bool B_Tree_iter_seek(struct B_Tree_iter *iter, const void *key) {
+static bool B_Tree_iter_seek_from(struct B_Tree_iter *iter,
+    struct B_Tree_node *root, const void *key)
+{
     iter->atend = false;
     iter->atstart = false;
     iter->seeked = false;
     iter->nstack = 0;
-    if (!iter->B_Tree->root) {
+    if (!root) {
         return false;
     }
     iter->seeked = true;
-    struct B_Tree_node *node = iter->B_Tree->root;
+    struct B_Tree_node *node = root;
     while (1) {
         bool found;
-        size_t i = B_Tree_node_bsearch(iter->B_Tree, node, key, &found);
+        size_t i = B_Tree_node_bsearch(iter->B_Tree, node, key, &found,
+            iter->B_Tree->kv_int);
         iter->stack[iter->nstack++] = (struct B_Tree_iter_stack_item) {
             .node = node,
             .index = i,
@@ -1352,14 +2071,42 @@ bool B_Tree_iter_seek(struct B_Tree_iter *iter, const void *key) {
     }
 }
 
+B_Tree_EXTERN
+bool B_Tree_iter_seek(struct B_Tree_iter *iter, const void *key) {
+    return B_Tree_iter_seek_from(iter, iter->B_Tree->root, key);
+}
+
 B_Tree_EXTERN
 const void *B_Tree_iter_item(struct B_Tree_iter *iter) {
     return iter->item;
 }
 
-// 创建一颗新的存储KV_Node元素的B树
+// 创建一颗新的存储KV_Node元素的B树, 使用按int key内联比较的特化实现
 struct B_Tree *b_tree_create(){
-    return B_Tree_new(sizeof(struct KV_Node), 0, kv_node_compare, NULL);
+    struct B_Tree *B_Tree = b_tree_create_generic();
+    if (B_Tree) B_Tree->kv_int = true;
+    return B_Tree;
+}
+
+// 创建一颗新的存储KV_Node元素的B树, 经由函数指针调用kv_node_compare比较;
+// 值日志作为udata, kv_node_compare不使用它
+struct B_Tree *b_tree_create_generic(){
+    Value_Log *log = value_log_create();
+    struct B_Tree *B_Tree = B_Tree_new(sizeof(struct KV_Node), 0,
+        kv_node_compare, log);
+    if (!B_Tree) value_log_destroy(log);
+    return B_Tree;
+}
+
+// 创建一颗定长值模式的B树, 元素以首个int为key, 同样走内联比较的特化实现; 没有值日志, udata为NULL
+struct B_Tree *b_tree_create_pod(size_t payload_size){
+    // b_tree_insert_pod在栈上按B_TREE_PAYLOAD_MAX组装元素, 超出的大小在运行期拒绝, 不只靠assert
+    if(payload_size % sizeof(int) != 0 || payload_size > B_TREE_PAYLOAD_MAX)
+        return NULL;
+    struct B_Tree *B_Tree = B_Tree_new(B_TREE_POD_ELSIZE(payload_size), 0,
+        kv_node_compare, NULL);
+    if (B_Tree) B_Tree->kv_int = true;
+    return B_Tree;
 }
 
 // 判断该B树中是否有键值为key的元素
@@ -1369,14 +2116,130 @@ bool b_tree_exist(const struct B_Tree *B_Tree, int key){
     return my_node != NULL;
 }
 
+// 把items中元素的值标记为失效, 用于元素未能进入B树时
+static void b_tree_release_values(Value_Log *log, const KV_Node *items,
+    size_t n){
+    for(size_t i = 0; i < n; i++)
+        value_log_release(log, items[i].val);
+}
+
+// 删除键值为key的元素并让其值失效, 不触发整理; 森林中的树共用值日志, 只能由森林整体整理
+static void b_tree_remove(struct B_Tree *B_Tree, int key){
+    const KV_Node *prev = B_Tree_delete(B_Tree, &(struct KV_Node){.key = key});
+    if(prev && B_Tree->udata) // 定长值模式下值在元素内, 随元素一起删除
+        value_log_release(B_Tree->udata, prev->val);
+}
+
+// 写入键值为key的元素并让被替换的旧值失效, 不触发整理, 理由同b_tree_remove
+static void b_tree_put(struct B_Tree *B_Tree, int key, const char *s){
+    Value_Log *log = B_Tree->udata;
+    if(!log) // 定长值模式下没有值日志, 只能用b_tree_insert_pod写入
+        return;
+    uint32_t val = value_log_append(log, s);
+    if(val == VALUE_LOG_NULL)
+        return;
+    const KV_Node *prev = B_Tree_set(B_Tree,
+        &(struct KV_Node){.key = key, .val = val});
+    if(prev)
+        value_log_release(log, prev->val);
+    else if(B_Tree_oom(B_Tree))
+        value_log_release(log, val);
+}
+
 // 删除B树中键值为key值得元素(如果有)
 void b_tree_erase(const struct B_Tree *B_Tree, int key){
-    B_Tree_delete(B_Tree, &key);
+    b_tree_remove((struct B_Tree*)B_Tree, key);
+    if(B_Tree->udata && value_log_need_compact(B_Tree->udata))
+        b_tree_compact((struct B_Tree*)B_Tree);
 }
 
 // 向B树中插入(或者更新)键值为key, value值为str字符串的元素
 void b_tree_insert(const struct B_Tree *B_Tree, int key, const char* s){
-    B_Tree_set(B_Tree, &(struct KV_Node){.key = key, .str = strdup(s)});
+    b_tree_put((struct B_Tree*)B_Tree, key, s);
+    if(B_Tree->udata && value_log_need_compact(B_Tree->udata))
+        b_tree_compact((struct B_Tree*)B_Tree);
+}
+
+// 向空B树中批量装入n个key严格递增的元素, 元素的val直接归B树所有
+bool b_tree_bulk_load(struct B_Tree *B_Tree, const KV_Node *items, size_t n){
+    if(!B_Tree->udata) // 定长值模式下没有值日志, 元素的val不是句柄
+        return false;
+    if(B_Tree_load_sorted(B_Tree, items, n))
+        return true;
+    b_tree_release_values(B_Tree->udata, items, n);
+    return false;
+}
+
+// b_tree_merge重建时收集B树中的现有元素
+static bool b_tree_collect(const void *item, void *udata){
+    KV_Node **tail = (KV_Node**)udata;
+    *(*tail)++ = *(const KV_Node*)item;
+    return true;
+}
+
+// 把n个key严格递增的元素并入B树, 重复key以新元素为准并让旧值失效, 不触发整理;
+// 并入的元素不少于现有元素的1/B_TREE_MERGE_REBUILD时, 把现有元素与新元素归并后自底向上重建,
+// 否则按key顺序带着上一次的hint逐个插入, 省去大部分从根开始的查找
+static bool b_tree_merge_values(struct B_Tree *B_Tree, const KV_Node *items,
+    size_t n){
+    Value_Log *log = B_Tree->udata;
+    if(!log) // 元素为带句柄的KV_Node, 定长值模式不适用
+        return false;
+    size_t count = B_Tree_count(B_Tree);
+    if(count == 0)
+        return b_tree_bulk_load(B_Tree, items, n);
+    if(n < B_TREE_MERGE_MIN || n * B_TREE_MERGE_REBUILD < count){
+        uint64_t hint = 0;
+        for(size_t i = 0; i < n; i++){
+            const KV_Node *prev = B_Tree_set_hint(B_Tree, &items[i], &hint);
+            if(prev){
+                value_log_release(log, prev->val);
+            }else if(B_Tree_oom(B_Tree)){
+                b_tree_release_values(log, items + i, n - i);
+                return false;
+            }
+        }
+        return true;
+    }
+    // 现有元素收集到buf[n, n+count), 归并结果从buf[0]写起, 写入位置不会越过读取位置;
+    // 被替换的旧值在重建成功后才失效, 重建失败时B树保持原样
+    KV_Node *buf = (KV_Node*)malloc((count + n) * sizeof(KV_Node));
+    uint32_t *dup = (uint32_t*)malloc(n * sizeof(uint32_t));
+    if(!buf || !dup){
+        free(buf);
+        free(dup);
+        b_tree_release_values(log, items, n);
+        return false;
+    }
+    KV_Node *a = buf + n, *a_end = buf + n;
+    B_Tree_ascend(B_Tree, NULL, b_tree_collect, &a_end);
+    size_t j = 0, m = 0, dup_num = 0;
+    while(a < a_end || j < n){
+        if(j == n || (a < a_end && a->key < items[j].key)){
+            buf[m++] = *a++;
+        }else{
+            if(a < a_end && a->key == items[j].key)
+                dup[dup_num++] = (a++)->val;
+            buf[m++] = items[j++];
+        }
+    }
+    bool ok = B_Tree_rebuild_sorted(B_Tree, buf, m);
+    if(ok){
+        for(size_t i = 0; i < dup_num; i++)
+            value_log_release(log, dup[i]);
+    }else{
+        b_tree_release_values(log, items, n);
+    }
+    free(buf);
+    free(dup);
+    return ok;
+}
+
+bool b_tree_merge(struct B_Tree *B_Tree, const KV_Node *items, size_t n){
+    bool ok = b_tree_merge_values(B_Tree, items, n);
+    if(B_Tree->udata && value_log_need_compact(B_Tree->udata))
+        b_tree_compact(B_Tree);
+    return ok;
 }
 
 // 返回键值key对应的B树元素, 若是无则返回NULL
@@ -1386,6 +2249,56 @@ KV_Node* b_tree_query(const struct B_Tree *B_Tree, int key){
     return node;
 }
 
+KV_Node* b_tree_query_hint(const struct B_Tree *B_Tree, int key,
+    uint64_t *hint){
+    return B_Tree_get_hint(B_Tree, &(struct KV_Node){.key = key}, hint);
+}
+
+const char *b_tree_value(const struct B_Tree *B_Tree, const KV_Node *node){
+    return node && B_Tree->udata ? value_log_get(B_Tree->udata, node->val) :
+        NULL;
+}
+
+// 以栈上的元素组装key与值后写入, 值直接复制进节点, 不做任何堆分配
+void b_tree_insert_pod(const struct B_Tree *B_Tree, int key, const void *val){
+    int item[B_TREE_POD_ELSIZE(B_TREE_PAYLOAD_MAX) / sizeof(int)];
+    item[0] = key;
+    memcpy(item + 1, val, B_Tree->elsize - sizeof(int));
+    B_Tree_set((struct B_Tree*)B_Tree, item);
+}
+
+bool b_tree_query_pod(const struct B_Tree *B_Tree, int key, void *val){
+    return b_tree_payload(B_Tree, b_tree_query(B_Tree, key), val);
+}
+
+bool b_tree_payload(const struct B_Tree *B_Tree, const KV_Node *node,
+    void *val){
+    if(!node)
+        return false;
+    memcpy(val, (const int*)node + 1, B_Tree->elsize - sizeof(int));
+    return true;
+}
+
+// 把子树中位于待整理段的值搬走, 直接改写元素中的句柄; key不变, 节点的key数组无需同步
+static void b_tree_node_relocate(Value_Log *log, struct B_Tree_node *node){
+    KV_Node *items = (KV_Node*)node->items;
+    for(size_t i = 0; i < node->nitems; i++)
+        items[i].val = value_log_relocate(log, items[i].val);
+    if(!node->leaf){
+        for(size_t i = 0; i <= node->nitems; i++)
+            b_tree_node_relocate(log, node->children[i]);
+    }
+}
+
+void b_tree_compact(struct B_Tree *B_Tree){
+    Value_Log *log = B_Tree->udata;
+    if(!log)
+        return;
+    if(value_log_compact_begin(log) > 0 && B_Tree->root)
+        b_tree_node_relocate(log, B_Tree->root);
+    value_log_compact_end(log);
+}
+
 // 打印B树中节点的信息
 void print_node(const struct B_Tree *B_Tree, int key){
     struct KV_Node* node = NULL;
@@ -1394,13 +2307,613 @@ void print_node(const struct B_Tree *B_Tree, int key){
         printf("<-----key值为 %d 的元素未找到----->\n", key);
         return;
     }else{
-        print_kv_node(node);
+        print_kv_node(node, b_tree_value(B_Tree, node));
     }
 }
 
-// 释放B树内存
+// 释放B树内存, 值日志整体释放, 不必逐个元素让值失效
 void b_tree_free(struct B_Tree *B_Tree){
+    Value_Log *log = B_Tree->udata;
     B_Tree_free(B_Tree);
+    if(log)
+        value_log_destroy(log);
+}
+
+// 把第i棵树的状态装入其节点形状共享的B树头部, 之后即可用B_Tree_*函数修改这棵树;
+// 只用于写操作, 因此顺带让上一次b_forest_upsert推迟失效的旧值失效
+static struct B_Tree *b_forest_bind(const B_Forest *forest, int i){
+    if(forest->retired != VALUE_LOG_NULL){
+        value_log_release(forest->vlog, forest->retired);
+        ((B_Forest*)forest)->retired = VALUE_LOG_NULL;
+    }
+    const B_Forest_Tree *tree = &forest->tree[i];
+    struct B_Tree *B_Tree = forest->shared[tree->shape];
+    B_Tree->root = tree->root;
+    B_Tree->count = tree->count;
+    B_Tree->height = tree->height;
+    return B_Tree;
+}
+
+// 返回下标不小于i的第一棵非空树, 没有时返回tree_num; 按非空位图每次跳过64棵树
+static int b_forest_next_nonempty(const B_Forest *forest, int i){
+    if(i >= forest->tree_num)
+        return forest->tree_num;
+    int w = i >> 6;
+    uint64_t bits = forest->nonempty[w] & (~(uint64_t)0 << (i & 63));
+    int words = (forest->tree_num + 63) >> 6;
+    while(!bits){
+        if(++w == words)
+            return forest->tree_num;
+        bits = forest->nonempty[w];
+    }
+    return (w << 6) + __builtin_ctzll(bits);
+}
+
+// 返回下标不大于i的最后一棵非空树, 没有时返回-1
+static int b_forest_prev_nonempty(const B_Forest *forest, int i){
+    if(i < 0)
+        return -1;
+    int w = i >> 6;
+    uint64_t bits = forest->nonempty[w] & (~(uint64_t)0 >> (63 - (i & 63)));
+    while(!bits){
+        if(--w < 0)
+            return -1;
+        bits = forest->nonempty[w];
+    }
+    return (w << 6) + 63 - __builtin_clzll(bits);
+}
+
+// 把第i棵树元素数的变化delta累加到树状数组
+static void b_forest_fenwick_add(const B_Forest *forest, int i, size_t delta){
+    for(i++; i <= forest->tree_num; i += i & -i)
+        forest->fenwick[i] += delta;
+}
+
+// 返回前i棵树(下标小于i)的元素总数
+static size_t b_forest_fenwick_prefix(const B_Forest *forest, int i){
+    size_t sum = 0;
+    for(; i > 0; i -= i & -i)
+        sum += forest->fenwick[i];
+    return sum;
+}
+
+// 把修改后的状态写回第i棵树, 树在空与非空之间变化时更新非空位图和首末非空树,
+// 排名模式下把元素数的变化计入树状数组; 森林的写操作不并发, 因此可以在这里改写森林头部
+static void b_forest_store(const B_Forest *forest, int i){
+    B_Forest_Tree *tree = &forest->tree[i];
+    const struct B_Tree *B_Tree = forest->shared[tree->shape];
+    bool was_empty = tree->root == NULL;
+    if(forest->fenwick && tree->count != B_Tree->count)
+        b_forest_fenwick_add(forest, i, B_Tree->count - tree->count);
+    tree->root = B_Tree->root;
+    tree->count = (uint32_t)B_Tree->count;
+    tree->height = (uint16_t)B_Tree->height;
+    if(was_empty == (tree->root == NULL))
+        return;
+    B_Forest *mut = (B_Forest*)forest;
+    if(tree->root){
+        mut->nonempty[i >> 6] |= (uint64_t)1 << (i & 63);
+        if(i < mut->first) mut->first = i;
+        if(i > mut->last) mut->last = i;
+    }else{
+        mut->nonempty[i >> 6] &= ~((uint64_t)1 << (i & 63));
+        if(i == mut->first) mut->first = b_forest_next_nonempty(forest, i);
+        if(i == mut->last) mut->last = b_forest_prev_nonempty(forest, i);
+    }
+}
+
+// 创建节点容量为max_items(0为默认值)、节点从森林slab中分配、值写入森林值日志的共享配置,
+// 元素大小取森林当前的elsize
+static struct B_Tree *b_forest_shared_create(B_Forest *forest,
+    size_t max_items){
+    // B_Tree_new把max_items规整为2*(max_items/2)-1, 传入max_items+1以保留奇数容量
+    struct B_Tree *B_Tree = B_Tree_new(forest->elsize,
+        max_items ? max_items + 1 : 0, kv_node_compare, forest->vlog);
+    B_Tree->kv_int = true;
+    B_Tree_set_ranked(B_Tree, forest->fenwick != NULL);
+    B_Tree_set_node_allocator(B_Tree, slab_alloc, slab_free, forest->slab);
+    return B_Tree;
+}
+
+B_Forest *b_forest_create(int tree_num){
+    B_Forest *forest = (B_Forest*)malloc(sizeof(B_Forest));
+    forest->slab = slab_create();
+    forest->vlog = value_log_create();
+    forest->elsize = sizeof(struct KV_Node);
+    forest->retired = VALUE_LOG_NULL;
+    forest->fenwick = NULL;
+    forest->shared[0] = b_forest_shared_create(forest, 0);
+    forest->shape_num = 1;
+    forest->tree = (B_Forest_Tree*)calloc(tree_num, sizeof(B_Forest_Tree));
+    forest->nonempty = (uint64_t*)calloc((tree_num + 63) / 64, sizeof(uint64_t));
+    forest->first = tree_num;
+    forest->last = -1;
+    forest->tree_num = tree_num;
+    return forest;
+}
+
+void b_forest_free(B_Forest *forest){
+    // 所有节点都在森林的slab中, 整体归还arena即可, 不必逐棵树逐个节点释放
+    for(int s = 0; s < forest->shape_num; s++){
+        forest->shared[s]->root = NULL;
+        B_Tree_free(forest->shared[s]);
+    }
+    slab_destroy(forest->slab);
+    if(forest->vlog)
+        value_log_destroy(forest->vlog);
+    free(forest->tree);
+    free(forest->nonempty);
+    free(forest->fenwick);
+    free(forest);
+}
+
+// 节点容量为m的叶子节点的字节数: 节点头、元素数组和带填充的key数组
+static size_t b_tree_leaf_bytes(size_t m, size_t elsize){
+    return sizeof(struct B_Tree_node) + elsize * m +
+        sizeof(int) * (m + B_Tree_KEY_PAD);
+}
+
+size_t b_tree_fit_max_items(size_t expected, size_t elsize){
+    // 容量取2^k-1的阶梯, 森林中的节点形状因此不超过B_FOREST_SHAPE_MAX种
+    double target = expected * B_TREE_FANOUT_SLACK;
+    size_t m = B_TREE_FANOUT_MIN;
+    while(m < target && m < B_TREE_FANOUT_MAX)
+        m = m * 2 + 1;
+    // 按缓存行取整后, 把剩余的空间也用作元素
+    size_t lines = (b_tree_leaf_bytes(m, elsize) + CACHE_LINE - 1) / CACHE_LINE;
+    while(b_tree_leaf_bytes(m + 2, elsize) <= lines * CACHE_LINE)
+        m += 2;
+    return m;
+}
+
+bool b_forest_set_payload(B_Forest *forest, size_t payload_size){
+    // 同b_tree_create_pod, 不合要求的大小在运行期拒绝, 森林保持原样
+    if(payload_size % sizeof(int) != 0 || payload_size > B_TREE_PAYLOAD_MAX)
+        return false;
+    for(int i = 0; i < forest->tree_num; i++)
+        assert(forest->tree[i].root == NULL);
+    if(forest->vlog){
+        value_log_destroy(forest->vlog);
+        forest->vlog = NULL;
+    }
+    forest->elsize = B_TREE_POD_ELSIZE(payload_size);
+    // 按原有容量重建各形状的共享配置, 各树的形状下标不变
+    for(int s = 0; s < forest->shape_num; s++){
+        size_t max_items = forest->shared[s]->max_items;
+        B_Tree_free(forest->shared[s]);
+        forest->shared[s] = b_forest_shared_create(forest, max_items);
+    }
+    return true;
+}
+
+void b_forest_set_max_items(B_Forest *forest, int i, size_t max_items){
+    assert(forest->tree[i].root == NULL);
+    int best = -1;
+    for(int s = 0; s < forest->shape_num; s++)
+        if(forest->shared[s]->max_items == max_items)
+            best = s;
+    if(best < 0 && forest->shape_num < B_FOREST_SHAPE_MAX){
+        best = forest->shape_num++;
+        forest->shared[best] = b_forest_shared_create(forest, max_items);
+    }
+    if(best < 0){
+        // 形状已满时取容量不小于max_items的最小形状, 都不够时取最大的
+        for(int s = 0; s < forest->shape_num; s++){
+            size_t have = forest->shared[s]->max_items;
+            if(best < 0 ||
+               (have >= max_items
+                    ? have < forest->shared[best]->max_items ||
+                          forest->shared[best]->max_items < max_items
+                    : have > forest->shared[best]->max_items &&
+                          forest->shared[best]->max_items < max_items))
+                best = s;
+        }
+    }
+    forest->tree[i].shape = (uint16_t)best;
+}
+
+void b_forest_set_ranked(B_Forest *forest, bool enable){
+    for(int i = 0; i < forest->tree_num; i++)
+        assert(forest->tree[i].root == NULL);
+    free(forest->fenwick);
+    forest->fenwick = enable ?
+        (size_t*)calloc(forest->tree_num + 1, sizeof(size_t)) : NULL;
+    for(int s = 0; s < forest->shape_num; s++)
+        B_Tree_set_ranked(forest->shared[s], enable);
+}
+
+size_t b_forest_memory(const B_Forest *forest){
+    return forest->tree_num * sizeof(B_Forest_Tree) +
+        (forest->tree_num + 63) / 64 * sizeof(uint64_t) +
+        (forest->fenwick ? (forest->tree_num + 1) * sizeof(size_t) : 0) +
+        (size_t)forest->slab->arena_num * SLAB_ARENA_SIZE +
+        (forest->vlog ? value_log_memory(forest->vlog) : 0);
+}
+
+void b_forest_compact(const B_Forest *forest){
+    if(!forest->vlog)
+        return;
+    if(value_log_compact_begin(forest->vlog) > 0){
+        for(int i = 0; i < forest->tree_num; i++)
+            if(forest->tree[i].root)
+                b_tree_node_relocate(forest->vlog, forest->tree[i].root);
+    }
+    value_log_compact_end(forest->vlog);
+}
+
+const char *b_forest_value(const B_Forest *forest, const KV_Node *node){
+    return node && forest->vlog ? value_log_get(forest->vlog, node->val) :
+        NULL;
+}
+
+bool b_forest_payload(const B_Forest *forest, const KV_Node *node, void *val){
+    if(!node)
+        return false;
+    memcpy(val, (const int*)node + 1, forest->elsize - sizeof(int));
+    return true;
+}
+
+size_t b_forest_count(const B_Forest *forest, int i){
+    return forest->tree[i].count;
+}
+
+size_t b_forest_count_range(const B_Forest *forest, int first, int last){
+    if(first > last)
+        return 0;
+    if(forest->fenwick)
+        return b_forest_fenwick_prefix(forest, last + 1) -
+            b_forest_fenwick_prefix(forest, first);
+    size_t sum = 0;
+    for(int i = first; i <= last; i++)
+        sum += forest->tree[i].count;
+    return sum;
+}
+
+size_t b_forest_height(const B_Forest *forest, int i){
+    return forest->tree[i].height;
+}
+
+bool b_forest_exist(const B_Forest *forest, int i, int key){
+    return b_forest_query(forest, i, key) != NULL;
+}
+
+void b_forest_erase(const B_Forest *forest, int i, int key){
+    if(!forest->tree[i].root)
+        return;
+    b_tree_remove(b_forest_bind(forest, i), key);
+    b_forest_store(forest, i);
+    if(forest->vlog && value_log_need_compact(forest->vlog))
+        b_forest_compact(forest);
+}
+
+void b_forest_insert(const B_Forest *forest, int i, int key, const char *s){
+    if(!forest->vlog) // 定长值模式下只能用b_forest_insert_pod写入
+        return;
+    b_tree_put(b_forest_bind(forest, i), key, s);
+    b_forest_store(forest, i);
+    if(value_log_need_compact(forest->vlog))
+        b_forest_compact(forest);
+}
+
+void b_forest_insert_pod(const B_Forest *forest, int i, int key,
+    const void *val){
+    b_tree_insert_pod(b_forest_bind(forest, i), key, val);
+    b_forest_store(forest, i);
+}
+
+bool b_forest_query_pod(const B_Forest *forest, int i, int key, void *val){
+    return b_forest_payload(forest, b_forest_query(forest, i, key), val);
+}
+
+const char *b_forest_upsert(const B_Forest *forest, int i, int key,
+    const char *s, bool *ok){
+    if(ok)
+        *ok = false;
+    if(!forest->vlog)
+        return NULL;
+    struct B_Tree *B_Tree = b_forest_bind(forest, i);
+    uint32_t val = value_log_append(forest->vlog, s);
+    if(val == VALUE_LOG_NULL)
+        return NULL;
+    const KV_Node *prev = B_Tree_set(B_Tree,
+        &(struct KV_Node){.key = key, .val = val});
+    b_forest_store(forest, i);
+    if(prev){
+        // 旧值推迟到下一次写入时才失效, 本次也不整理, 返回的字符串因此保持有效
+        ((B_Forest*)forest)->retired = prev->val;
+        if(ok)
+            *ok = true;
+        return value_log_get(forest->vlog, prev->val);
+    }
+    if(B_Tree_oom(B_Tree)){
+        value_log_release(forest->vlog, val);
+        return NULL;
+    }
+    if(ok)
+        *ok = true;
+    if(value_log_need_compact(forest->vlog))
+        b_forest_compact(forest);
+    return NULL;
+}
+
+KV_Node* b_forest_get_or_insert(const B_Forest *forest, int i, int key,
+    const char *s, bool *inserted){
+    if(!forest->vlog){
+        if(inserted)
+            *inserted = false;
+        return NULL;
+    }
+    struct B_Tree *B_Tree = b_forest_bind(forest, i);
+    bool added = false;
+    // 先以空句柄占位, 确实插入了新元素时才把s追加到值日志
+    KV_Node *node = B_Tree_get_or_set(B_Tree,
+        &(struct KV_Node){.key = key, .val = VALUE_LOG_NULL}, &added);
+    if(node && added){
+        node->val = value_log_append(forest->vlog, s);
+        if(node->val == VALUE_LOG_NULL){
+            B_Tree_delete(B_Tree, &(struct KV_Node){.key = key});
+            node = NULL;
+            added = false;
+        }
+    }
+    b_forest_store(forest, i);
+    if(inserted)
+        *inserted = added;
+    // 整理只改写元素中的句柄, 元素不移动, node仍然有效
+    if(value_log_need_compact(forest->vlog))
+        b_forest_compact(forest);
+    return node;
+}
+
+bool b_forest_update(const B_Forest *forest, int i, int key, KV_Update fn,
+    void *udata){
+    if(!forest->vlog || !forest->tree[i].root)
+        return false;
+    struct B_Tree *B_Tree = b_forest_bind(forest, i);
+    KV_Node *node = B_Tree_get_mut(B_Tree, &(struct KV_Node){.key = key});
+    b_forest_store(forest, i);
+    if(!node)
+        return false;
+    const char *old = value_log_get(forest->vlog, node->val);
+    const char *s = fn(key, old, udata);
+    if(s && s != old){
+        uint32_t val = value_log_append(forest->vlog, s);
+        if(val != VALUE_LOG_NULL){
+            value_log_release(forest->vlog, node->val);
+            node->val = val;
+        }
+        if(value_log_need_compact(forest->vlog))
+            b_forest_compact(forest);
+    }
+    return true;
+}
+
+bool b_forest_merge(const B_Forest *forest, int i, const KV_Node *items,
+    size_t n){
+    if(!forest->vlog)
+        return false;
+    bool ok = b_tree_merge_values(b_forest_bind(forest, i), items, n);
+    b_forest_store(forest, i);
+    if(value_log_need_compact(forest->vlog))
+        b_forest_compact(forest);
+    return ok;
+}
+
+bool b_forest_ascend(const B_Forest *forest, int i, const void *pivot,
+    bool (*iter)(const void *item, void *udata), void *udata){
+    const B_Forest_Tree *tree = &forest->tree[i];
+    return B_Tree_ascend_from(forest->shared[tree->shape], tree->root, pivot,
+        iter, udata, NULL);
+}
+
+void b_forest_prefetch(const B_Forest *forest, int i){
+    __builtin_prefetch(forest->tree[i].root);
+}
+
+// b_forest_range的遍历状态
+typedef struct B_Forest_Range {
+    KV_Visit fn;
+    void *udata;
+    int hi;    // 遇到key大于hi的元素即结束
+    bool stop; // fn要求停止
+} B_Forest_Range;
+
+static bool b_forest_range_visit(const void *item, void *udata){
+    B_Forest_Range *range = (B_Forest_Range*)udata;
+    const KV_Node *node = (const KV_Node*)item;
+    if(node->key > range->hi)
+        return false;
+    if(!range->fn(node, range->udata)){
+        range->stop = true;
+        return false;
+    }
+    return true;
+}
+
+bool b_forest_range(const B_Forest *forest, int first, int last, int lo,
+    int hi, KV_Visit fn, void *udata){
+    B_Forest_Range range = {fn, udata, hi, false};
+    const KV_Node pivot = {.key = lo};
+    for(int i = first; i <= last && !range.stop; i++){
+        // 扫描当前树的同时把下一棵树的根节点取进缓存
+        if(i < last)
+            b_forest_prefetch(forest, i + 1);
+        // 只有第一棵树需要从lo开始查找, 之后的树中的key都不小于lo
+        if(!b_forest_ascend(forest, i, i == first ? &pivot : NULL,
+                            b_forest_range_visit, &range))
+            break;
+    }
+    return !range.stop;
+}
+
+// 森林的游标: 一个栈深为B_FOREST_CURSOR_DEPTH的B树迭代器在各树之间复用
+struct B_Forest_Cursor {
+    const B_Forest *forest;
+    int tree;                  // 迭代器当前所在树的下标
+    struct B_Tree_iter *iter;
+};
+
+B_Forest_Cursor *b_forest_cursor_new(const B_Forest *forest){
+    B_Forest_Cursor *cursor = (B_Forest_Cursor*)malloc(sizeof(B_Forest_Cursor));
+    cursor->forest = forest;
+    cursor->tree = -1;
+    cursor->iter = B_Tree_iter_alloc(forest->shared[0], B_FOREST_CURSOR_DEPTH);
+    return cursor;
+}
+
+void b_forest_cursor_free(B_Forest_Cursor *cursor){
+    B_Tree_iter_free(cursor->iter);
+    free(cursor);
+}
+
+// 让迭代器改用第i棵树的形状配置, 各形状的元素大小与比较方式相同, 只为节点容量不同
+static struct B_Tree_node *b_forest_cursor_enter(B_Forest_Cursor *cursor,
+    int i){
+    const B_Forest_Tree *tree = &cursor->forest->tree[i];
+    assert(tree->height <= B_FOREST_CURSOR_DEPTH);
+    cursor->tree = i;
+    cursor->iter->B_Tree = cursor->forest->shared[tree->shape];
+    return tree->root;
+}
+
+// 从第i棵树起向后找到第一棵非空树并停在其第一个元素上
+static bool b_forest_cursor_forward(B_Forest_Cursor *cursor, int i){
+    i = b_forest_next_nonempty(cursor->forest, i);
+    if(i < cursor->forest->tree_num)
+        return B_Tree_iter_first_from(cursor->iter,
+            b_forest_cursor_enter(cursor, i));
+    cursor->tree = -1;
+    return false;
+}
+
+// 从第i棵树起向前找到第一棵非空树并停在其最后一个元素上
+static bool b_forest_cursor_backward(B_Forest_Cursor *cursor, int i){
+    i = b_forest_prev_nonempty(cursor->forest, i);
+    if(i >= 0)
+        return B_Tree_iter_last_from(cursor->iter,
+            b_forest_cursor_enter(cursor, i));
+    cursor->tree = -1;
+    return false;
+}
+
+bool b_forest_cursor_seek(B_Forest_Cursor *cursor, int i, int key){
+    if(B_Tree_iter_seek_from(cursor->iter, b_forest_cursor_enter(cursor, i),
+                             &(struct KV_Node){.key = key}))
+        return true;
+    return b_forest_cursor_forward(cursor, i + 1);
+}
+
+bool b_forest_cursor_first(B_Forest_Cursor *cursor){
+    return b_forest_cursor_forward(cursor, cursor->forest->first);
+}
+
+bool b_forest_cursor_last(B_Forest_Cursor *cursor){
+    return b_forest_cursor_backward(cursor, cursor->forest->last);
+}
+
+bool b_forest_cursor_next(B_Forest_Cursor *cursor){
+    if(cursor->tree < 0)
+        return false;
+    if(B_Tree_iter_next(cursor->iter))
+        return true;
+    return b_forest_cursor_forward(cursor, cursor->tree + 1);
+}
+
+bool b_forest_cursor_prev(B_Forest_Cursor *cursor){
+    if(cursor->tree < 0)
+        return false;
+    if(B_Tree_iter_prev(cursor->iter))
+        return true;
+    return b_forest_cursor_backward(cursor, cursor->tree - 1);
+}
+
+const KV_Node *b_forest_cursor_item(const B_Forest_Cursor *cursor){
+    return cursor->tree < 0 ? NULL :
+        (const KV_Node*)B_Tree_iter_item(cursor->iter);
+}
+
+KV_Node* b_forest_ceiling(const B_Forest *forest, int i, int key){
+    const B_Forest_Tree *tree = &forest->tree[i];
+    const void *item = B_Tree_bound_from(forest->shared[tree->shape],
+        tree->root, &(struct KV_Node){.key = key}, false);
+    if(!item){
+        // 第i棵树中没有不小于key的元素, 答案是其后第一棵非空树的最小元素
+        i = b_forest_next_nonempty(forest, i + 1);
+        if(i < forest->tree_num){
+            tree = &forest->tree[i];
+            item = B_Tree_min_from(forest->shared[tree->shape], tree->root);
+        }
+    }
+    return (KV_Node*)item;
+}
+
+KV_Node* b_forest_floor(const B_Forest *forest, int i, int key){
+    const B_Forest_Tree *tree = &forest->tree[i];
+    const void *item = B_Tree_bound_from(forest->shared[tree->shape],
+        tree->root, &(struct KV_Node){.key = key}, true);
+    if(!item){
+        i = b_forest_prev_nonempty(forest, i - 1);
+        if(i >= 0){
+            tree = &forest->tree[i];
+            item = B_Tree_max_from(forest->shared[tree->shape], tree->root);
+        }
+    }
+    return (KV_Node*)item;
+}
+
+KV_Node* b_forest_min(const B_Forest *forest){
+    if(forest->first >= forest->tree_num)
+        return NULL;
+    const B_Forest_Tree *tree = &forest->tree[forest->first];
+    return (KV_Node*)B_Tree_min_from(forest->shared[tree->shape], tree->root);
+}
+
+KV_Node* b_forest_max(const B_Forest *forest){
+    if(forest->last < 0)
+        return NULL;
+    const B_Forest_Tree *tree = &forest->tree[forest->last];
+    return (KV_Node*)B_Tree_max_from(forest->shared[tree->shape], tree->root);
+}
+
+size_t b_forest_rank(const B_Forest *forest, int i, int key){
+    assert(forest->fenwick != NULL);
+    const B_Forest_Tree *tree = &forest->tree[i];
+    return b_forest_fenwick_prefix(forest, i) +
+        B_Tree_rank_from(forest->shared[tree->shape], tree->root,
+                         &(struct KV_Node){.key = key});
+}
+
+KV_Node* b_forest_select(const B_Forest *forest, size_t index){
+    assert(forest->fenwick != NULL);
+    // 在树状数组上自高位向低位下降, 找到前缀和不超过index的最长前缀, 即index所在的树
+    int pos = 0, step = 1;
+    while(step * 2 <= forest->tree_num)
+        step *= 2;
+    for(; step; step /= 2){
+        if(pos + step <= forest->tree_num &&
+           forest->fenwick[pos + step] <= index){
+            pos += step;
+            index -= forest->fenwick[pos];
+        }
+    }
+    if(pos >= forest->tree_num)
+        return NULL;
+    const B_Forest_Tree *tree = &forest->tree[pos];
+    return (KV_Node*)B_Tree_select_from(forest->shared[tree->shape],
+                                        tree->root, index);
+}
+
+KV_Node* b_forest_query(const B_Forest *forest, int i, int key){
+    const B_Forest_Tree *tree = &forest->tree[i];
+    return (KV_Node*)B_Tree_get_from(forest->shared[tree->shape], tree->root,
+        &(struct KV_Node){.key = key}, NULL);
+}
+
+KV_Node* b_forest_query_hint(const B_Forest *forest, int i, int key,
+    uint64_t *hint){
+    const B_Forest_Tree *tree = &forest->tree[i];
+    return (KV_Node*)B_Tree_get_from(forest->shared[tree->shape], tree->root,
+        &(struct KV_Node){.key = key}, hint);
 }
 
 #ifdef B_Tree_TEST_PRIVATE_FUNCTIONS
@@ -0,0 +1,337 @@
+#include "../inc/distribution.h"
+
+Distribution dist_gaussian(double mean, double sigma) {
+    Distribution dist = {.type = DIST_GAUSSIAN, .mean = mean, .sigma = sigma};
+    return dist;
+}
+
+Distribution dist_uniform(double lo, double hi) {
+    assert(hi > lo);
+    Distribution dist = {.type = DIST_UNIFORM, .lo = lo, .hi = hi};
+    return dist;
+}
+
+Distribution dist_lognormal(double shift, double mu, double sigma) {
+    Distribution dist = {
+        .type = DIST_LOGNORMAL, .shift = shift, .mean = mu, .sigma = sigma};
+    return dist;
+}
+
+Distribution dist_exponential(double shift, double lambda) {
+    assert(lambda > 0.0);
+    Distribution dist = {
+        .type = DIST_EXPONENTIAL, .shift = shift, .lambda = lambda};
+    return dist;
+}
+
+Distribution dist_zipf(double lo, double hi, double s) {
+    assert(hi > lo && s > 0.0);
+    Distribution dist = {.type = DIST_ZIPF, .lo = lo, .hi = hi, .s = s};
+    return dist;
+}
+
+Distribution dist_mixture(int mix_num, const double *weight, const double *mean,
+                          const double *sigma) {
+    assert(mix_num > 0 && mix_num <= MIX_MAX);
+    Distribution dist = {.type = DIST_MIXTURE, .mix_num = mix_num};
+    double sum = 0.0;
+    for (int i = 0; i < mix_num; i++) {
+        sum += weight[i];
+    }
+    for (int i = 0; i < mix_num; i++) {
+        dist.weight[i] = weight[i] / sum; // 权重归一化
+        dist.mix_mean[i] = mean[i];
+        dist.mix_sigma[i] = sigma[i];
+    }
+    return dist;
+}
+
+const char *dist_name(const Distribution *dist) {
+    static const char *name[DIST_TYPE_NUM] = {
+        "Gaussian", "Uniform", "Lognormal", "Exponential", "Zipf", "Mixture"};
+    return name[dist->type];
+}
+
+// Zipf分布(截断幂律)在u = x - lo + 1处的未归一化累积值, u属于[1, hi - lo + 1]
+static double zipf_mass(double s, double u) {
+    if (fabs(s - 1.0) < EPSILON)
+        return log(u);
+    return (1.0 - pow(u, 1.0 - s)) / (s - 1.0);
+}
+
+double dist_cdf(const Distribution *dist, double x) {
+    switch (dist->type) {
+    case DIST_GAUSSIAN:
+        return normal_cdf(dist->mean, dist->sigma, x);
+    case DIST_UNIFORM:
+        if (x <= dist->lo)
+            return 0.0;
+        if (x >= dist->hi)
+            return 1.0;
+        return (x - dist->lo) / (dist->hi - dist->lo);
+    case DIST_LOGNORMAL:
+        if (x <= dist->shift)
+            return 0.0;
+        return normal_cdf(dist->mean, dist->sigma, log(x - dist->shift));
+    case DIST_EXPONENTIAL:
+        if (x <= dist->shift)
+            return 0.0;
+        return 1.0 - exp(-dist->lambda * (x - dist->shift));
+    case DIST_ZIPF:
+        if (x <= dist->lo)
+            return 0.0;
+        if (x >= dist->hi)
+            return 1.0;
+        return zipf_mass(dist->s, x - dist->lo + 1.0) /
+               zipf_mass(dist->s, dist->hi - dist->lo + 1.0);
+    case DIST_MIXTURE: {
+        double y = 0.0;
+        for (int i = 0; i < dist->mix_num; i++) {
+            y += dist->weight[i] *
+                 normal_cdf(dist->mix_mean[i], dist->mix_sigma[i], x);
+        }
+        return y;
+    }
+    default:
+        assert(0);
+        return 0.0;
+    }
+}
+
+double dist_icdf(const Distribution *dist, double y) {
+    assert(y >= 0.0 && y <= 1.0);
+    switch (dist->type) {
+    case DIST_GAUSSIAN:
+        return normal_icdf(dist->mean, dist->sigma, y);
+    case DIST_UNIFORM:
+        return dist->lo + y * (dist->hi - dist->lo);
+    case DIST_LOGNORMAL:
+        return dist->shift + exp(normal_icdf(dist->mean, dist->sigma, y));
+    case DIST_EXPONENTIAL:
+        if (y >= 1.0)
+            return HUGE_VAL;
+        return dist->shift - log(1.0 - y) / dist->lambda;
+    case DIST_ZIPF: {
+        double total = zipf_mass(dist->s, dist->hi - dist->lo + 1.0);
+        double m = y * total;
+        double u;
+        if (fabs(dist->s - 1.0) < EPSILON)
+            u = exp(m);
+        else
+            u = pow(1.0 - m * (dist->s - 1.0), 1.0 / (1.0 - dist->s));
+        return dist->lo - 1.0 + u;
+    }
+    case DIST_MIXTURE: {
+        // 无解析解, 在所有分量的10倍标准差范围内二分
+        double left = dist->mix_mean[0] - 10.0 * dist->mix_sigma[0];
+        double right = dist->mix_mean[0] + 10.0 * dist->mix_sigma[0];
+        for (int i = 1; i < dist->mix_num; i++) {
+            left = fmin(left, dist->mix_mean[i] - 10.0 * dist->mix_sigma[i]);
+            right = fmax(right, dist->mix_mean[i] + 10.0 * dist->mix_sigma[i]);
+        }
+        while (right - left > EPSILON) {
+            double mid = (left + right) / 2.0;
+            if (mid <= left || mid >= right)
+                break;
+            if (dist_cdf(dist, mid) > y) {
+                right = mid;
+            } else {
+                left = mid;
+            }
+        }
+        return (right + left) / 2.0;
+    }
+    default:
+        assert(0);
+        return 0.0;
+    }
+}
+
+int dist_rand_integer(const Distribution *dist) {
+    double u = (rand() + 0.5) / (RAND_MAX + 1.0); // (0, 1)之间的均匀随机数
+    double x = dist_icdf(dist, u);
+    // 产生(INT_MIN, INT_MAX)之间的值
+    if (x > INT_MIN && x < INT_MAX) {
+        return (int)x;
+    }
+    return dist_rand_integer(dist);
+}
+
+static int dist_rand_adaptor(const void *udata) {
+    return dist_rand_integer((const Distribution *)udata);
+}
+
+int *dist_generate_sorted_arr(const Distribution *dist, int n) {
+    return generate_sorted_arr_by(n, dist_rand_adaptor, dist);
+}
+
+double dist_ks_statistic(const Distribution *dist, const int *sorted, int n) {
+    // 样本过多时等间隔抽取至多KS_MAX_POINTS个顺序统计量进行检验
+    int step = (n + KS_MAX_POINTS - 1) / KS_MAX_POINTS;
+    double d = 0.0;
+    for (int i = 0; i < n; i += step) {
+        double y = dist_cdf(dist, sorted[i]);
+        d = fmax(d, fmax(y - (double)i / n, (double)(i + 1) / n - y));
+    }
+    return d;
+}
+
+// 以黄金分割搜索使KS统计量最小的Zipf幂指数
+static Distribution dist_fit_zipf(const int *sorted, int n) {
+    double lo = sorted[0], hi = sorted[n - 1];
+    if (hi <= lo)
+        hi = lo + 1.0;
+    const double ratio = (sqrt(5.0) - 1.0) / 2.0;
+    double a = 0.01, b = 4.0;
+    double c = b - ratio * (b - a), d = a + ratio * (b - a);
+    Distribution dc = dist_zipf(lo, hi, c), dd = dist_zipf(lo, hi, d);
+    double fc = dist_ks_statistic(&dc, sorted, n);
+    double fd = dist_ks_statistic(&dd, sorted, n);
+    for (int iter = 0; iter < 40; iter++) {
+        if (fc < fd) {
+            b = d, d = c, fd = fc;
+            c = b - ratio * (b - a);
+            dc = dist_zipf(lo, hi, c);
+            fc = dist_ks_statistic(&dc, sorted, n);
+        } else {
+            a = c, c = d, fc = fd;
+            d = a + ratio * (b - a);
+            dd = dist_zipf(lo, hi, d);
+            fd = dist_ks_statistic(&dd, sorted, n);
+        }
+    }
+    return dist_zipf(lo, hi, (a + b) / 2.0);
+}
+
+// 在至多KS_MAX_POINTS个样本上以EM算法拟合mix_num个分量的高斯混合模型
+static Distribution dist_fit_mixture(const int *sorted, int n, int mix_num) {
+    int step = (n + KS_MAX_POINTS - 1) / KS_MAX_POINTS;
+    int m = (n + step - 1) / step;
+    double *resp = (double *)malloc((size_t)m * mix_num * sizeof(double));
+    double weight[MIX_MAX], mean[MIX_MAX], sigma[MIX_MAX];
+    double avg, sd;
+    statistic_feature((int *)sorted, n, &avg, &sd);
+    double min_sigma = fmax(1.0, sd * 1e-4); // 防止分量塌缩到单点
+    for (int j = 0; j < mix_num; j++) {
+        // 以分位数初始化各分量均值
+        weight[j] = 1.0 / mix_num;
+        mean[j] = sorted[(int)((j + 0.5) / mix_num * n)];
+        sigma[j] = fmax(sd / mix_num, min_sigma);
+    }
+    for (int iter = 0; iter < EM_ITERATION; iter++) {
+        // E步: 计算每个样本属于各分量的后验概率
+        for (int i = 0; i < m; i++) {
+            double x = sorted[i * step], sum = 0.0;
+            for (int j = 0; j < mix_num; j++) {
+                double z = (x - mean[j]) / sigma[j];
+                double p = weight[j] * exp(-0.5 * z * z) / sigma[j];
+                resp[i * mix_num + j] = p;
+                sum += p;
+            }
+            for (int j = 0; j < mix_num; j++) {
+                resp[i * mix_num + j] =
+                    (sum > 0.0) ? resp[i * mix_num + j] / sum : 1.0 / mix_num;
+            }
+        }
+        // M步: 更新权重、均值和标准差
+        for (int j = 0; j < mix_num; j++) {
+            double nj = 0.0, sum = 0.0, square_sum = 0.0;
+            for (int i = 0; i < m; i++) {
+                double r = resp[i * mix_num + j];
+                nj += r;
+                sum += r * sorted[i * step];
+            }
+            if (nj <= 0.0)
+                continue;
+            mean[j] = sum / nj;
+            for (int i = 0; i < m; i++) {
+                double dx = sorted[i * step] - mean[j];
+                square_sum += resp[i * mix_num + j] * dx * dx;
+            }
+            weight[j] = nj / m;
+            sigma[j] = fmax(sqrt(square_sum / nj), min_sigma);
+        }
+    }
+    free(resp);
+    return dist_mixture(mix_num, weight, mean, sigma);
+}
+
+Distribution dist_fit(const int *sorted, int n, double *ks) {
+    assert(n > 1);
+    double avg, sd;
+    statistic_feature((int *)sorted, n, &avg, &sd);
+    double lo = sorted[0], hi = sorted[n - 1];
+    if (hi <= lo)
+        hi = lo + 1.0;
+    Distribution cand[MIX_MAX + 4];
+    int cand_num = 0;
+    cand[cand_num++] = dist_gaussian(avg, sd);
+    cand[cand_num++] = dist_uniform(lo, hi);
+    // 对数正态与指数分布以略小于最小样本的位置为平移量
+    double shift = lo - 1.0;
+    double log_sum = 0.0, log_square_sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        double v = log(sorted[i] - shift);
+        log_sum += v;
+        log_square_sum += v * v;
+    }
+    double mu = log_sum / n;
+    double log_sd = sqrt(fmax((log_square_sum - n * mu * mu) / (n - 1), 0.0));
+    cand[cand_num++] = dist_lognormal(shift, mu, fmax(log_sd, EPSILON));
+    cand[cand_num++] = dist_exponential(shift, 1.0 / fmax(avg - shift, 1.0));
+    cand[cand_num++] = dist_fit_zipf(sorted, n);
+    for (int j = 2; j <= MIX_MAX; j++) {
+        cand[cand_num++] = dist_fit_mixture(sorted, n, j);
+    }
+    // 取KS统计量最小的候选分布
+    int best = 0;
+    double best_ks = dist_ks_statistic(&cand[0], sorted, n);
+    for (int i = 1; i < cand_num; i++) {
+        double d = dist_ks_statistic(&cand[i], sorted, n);
+        if (d < best_ks) {
+            best = i;
+            best_ks = d;
+        }
+    }
+    if (ks)
+        *ks = best_ks;
+    return cand[best];
+}
+
+void dist_linear_fitting(const Distribution *dist, int left, int right,
+                         double *k, double *b, int base) {
+    double y0 = dist_cdf(dist, (double)left);
+    double y1 = dist_cdf(dist, (double)right);
+    double width = (double)right - (double)left + 1.0;
+    if (y1 - y0 < EPSILON) {
+        // 该段概率质量可忽略(如重尾分布的远端)时, 退化为按key值均匀划分
+        *k = base / width;
+        *b = -(*k) * left;
+        return;
+    }
+    // 在[left, right]段上按概率等分取点, 而不是按key值等分,
+    // 这样即使该段大部分区域几乎没有概率质量, 拟合点也集中在key真正出现的位置
+    // 拟合精度只需以B树为单位, 取点数随base增长, 而不是固定取500点
+    int point_num = FIT_POINT_PER_BASE * base;
+    if (point_num < FIT_POINT_MIN)
+        point_num = FIT_POINT_MIN;
+    if (point_num > FIT_POINT_MAX)
+        point_num = FIT_POINT_MAX;
+    if (point_num > width)
+        point_num = (int)width;
+    double sum_x = 0.0, sum_y = 0.0, sum_xy = 0.0, sum_xx = 0.0;
+    for (int i = 0; i < point_num; i++) {
+        double t = (i + 0.5) / point_num;
+        double x = dist_icdf(dist, y0 + t * (y1 - y0));
+        x = fmin(fmax(x, (double)left), (double)right) - left; // 平移以减小量级
+        double y = t * base; // 重映射到[0, base)之间
+        sum_x += x;
+        sum_y += y;
+        sum_xy += x * y;
+        sum_xx += x * x;
+    }
+    double denominator = point_num * sum_xx - sum_x * sum_x;
+    *k = (denominator > 0.0) ? (point_num * sum_xy - sum_x * sum_y) / denominator
+                             : 0.0;
+    *b = (sum_y - (*k) * sum_x) / point_num - (*k) * left;
+}
@@ -7,45 +7,126 @@ Fool_Tree_Root* fool_tree_create(int left, int right, int b_tree_num){
     root->b_tree_num = b_tree_num;
     long long range_sum = (long long)right - (long long)left;
     root->range_num = range_sum / b_tree_num;// 每个B树负责的key值范围
-    root->b_tree_node = (struct B_Tree**)malloc(b_tree_num * sizeof(struct B_Tree*));
-    for(int i = 0; i < b_tree_num; i ++){
-        root->b_tree_node[i] = b_tree_create();
+    root->forest = b_forest_create(b_tree_num);
+    return root;
+}
+
+Fool_Tree_Root* fool_tree_create_pod(int left, int right, int b_tree_num,
+                                     size_t payload_size){
+    Fool_Tree_Root* root = fool_tree_create(left, right, b_tree_num);
+    if(!b_forest_set_payload(root->forest, payload_size)){
+        fool_tree_free(root);
+        return NULL;
     }
     return root;
 }
 
-struct B_Tree* fool_find_b_tree(const Fool_Tree_Root* root, int key){
+int fool_find_partition(const Fool_Tree_Root* root, int key){
     int b_tree_index = ((long long)key - root->left) / root->range_num;
     if(b_tree_index < 0) b_tree_index = 0;
     if(b_tree_index >= root->b_tree_num) b_tree_index = root->b_tree_num - 1;
-    return root->b_tree_node[b_tree_index];
+    return b_tree_index;
 }
 
 void fool_tree_free(Fool_Tree_Root* root){
-    for(int i = 0; i < root->b_tree_num; i ++){
-        b_tree_free(root->b_tree_node[i]);
-    }
-    free(root->b_tree_node);
+    b_forest_free(root->forest);
     free(root);
     root = NULL;
 }
 
 bool fool_tree_exist(const Fool_Tree_Root* root, int key){
-    return b_tree_exist(fool_find_b_tree(root, key), key);
+    return b_forest_exist(root->forest, fool_find_partition(root, key), key);
 }
 
 void fool_tree_erase(const Fool_Tree_Root* root, int key){
-    b_tree_erase(fool_find_b_tree(root, key), key);
+    b_forest_erase(root->forest, fool_find_partition(root, key), key);
 }
 
 void fool_tree_insert(const Fool_Tree_Root* root, int key, const char* s){
-    b_tree_insert(fool_find_b_tree(root, key), key, s);
+    b_forest_insert(root->forest, fool_find_partition(root, key), key, s);
+}
+
+const char* fool_tree_upsert(const Fool_Tree_Root* root, int key, const char* s,
+                             bool* ok){
+    return b_forest_upsert(root->forest, fool_find_partition(root, key), key, s, ok);
+}
+
+KV_Node* fool_tree_get_or_insert(const Fool_Tree_Root* root, int key, const char* s,
+                               bool* inserted){
+    return b_forest_get_or_insert(root->forest, fool_find_partition(root, key),
+                                  key, s, inserted);
+}
+
+bool fool_tree_update(const Fool_Tree_Root* root, int key, KV_Update fn,
+                      void* udata){
+    return b_forest_update(root->forest, fool_find_partition(root, key), key, fn,
+                           udata);
+}
+
+bool fool_tree_range(const Fool_Tree_Root* root, int lo, int hi, KV_Visit fn,
+                     void* udata){
+    if(lo > hi)
+        return true;
+    // 各B树负责的key值段依次相接, 按下标即按key有序
+    return b_forest_range(root->forest, fool_find_partition(root, lo),
+                          fool_find_partition(root, hi), lo, hi, fn, udata);
+}
+
+B_Forest_Cursor* fool_tree_cursor_new(const Fool_Tree_Root* root){
+    return b_forest_cursor_new(root->forest);
+}
+
+bool fool_tree_cursor_seek(const Fool_Tree_Root* root, B_Forest_Cursor* cursor,
+                           int key){
+    return b_forest_cursor_seek(cursor, fool_find_partition(root, key), key);
+}
+
+KV_Node* fool_tree_ceiling(const Fool_Tree_Root* root, int key){
+    return b_forest_ceiling(root->forest, fool_find_partition(root, key), key);
+}
+
+KV_Node* fool_tree_floor(const Fool_Tree_Root* root, int key){
+    return b_forest_floor(root->forest, fool_find_partition(root, key), key);
+}
+
+KV_Node* fool_tree_min(const Fool_Tree_Root* root){
+    return b_forest_min(root->forest);
+}
+
+KV_Node* fool_tree_max(const Fool_Tree_Root* root){
+    return b_forest_max(root->forest);
+}
+
+void fool_tree_set_ranked(Fool_Tree_Root* root, bool enable){
+    b_forest_set_ranked(root->forest, enable);
+}
+
+size_t fool_tree_rank(const Fool_Tree_Root* root, int key){
+    return b_forest_rank(root->forest, fool_find_partition(root, key), key);
+}
+
+KV_Node* fool_tree_select(const Fool_Tree_Root* root, size_t index){
+    return b_forest_select(root->forest, index);
 }
 
 KV_Node* fool_tree_query(const Fool_Tree_Root* root, int key){
-    return b_tree_query(fool_find_b_tree(root, key), key);
+    return b_forest_query(root->forest, fool_find_partition(root, key), key);
+}
+
+const char* fool_tree_value(const Fool_Tree_Root* root, const KV_Node* node){
+    return b_forest_value(root->forest, node);
+}
+
+void fool_tree_insert_pod(const Fool_Tree_Root* root, int key, const void* val){
+    b_forest_insert_pod(root->forest, fool_find_partition(root, key), key, val);
+}
+
+bool fool_tree_query_pod(const Fool_Tree_Root* root, int key, void* val){
+    return b_forest_query_pod(root->forest, fool_find_partition(root, key), key,
+                              val);
 }
 
 void print_fool_tree_node(const Fool_Tree_Root* root, int key){
-    print_kv_node(fool_find_b_tree(root, key));
+    KV_Node* node = fool_tree_query(root, key);
+    print_kv_node(node, fool_tree_value(root, node));
 }
\ No newline at end of file
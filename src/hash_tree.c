@@ -4,45 +4,80 @@ Hash_Tree_Root *hash_tree_create(int left, int right, int b_tree_num) {
     Hash_Tree_Root *root = (Hash_Tree_Root *)malloc(sizeof(Hash_Tree_Root));
     root->left = left, root->right = right;
     root->b_tree_num = b_tree_num;
-    root->b_tree_node =
-        (struct B_Tree **)malloc(b_tree_num * sizeof(struct B_Tree *));
-    for (int i = 0; i < b_tree_num; i++) {
-        root->b_tree_node[i] = b_tree_create();
+    root->forest = b_forest_create(b_tree_num);
+    return root;
+}
+
+Hash_Tree_Root *hash_tree_create_pod(int left, int right, int b_tree_num,
+                                     size_t payload_size) {
+    Hash_Tree_Root *root = hash_tree_create(left, right, b_tree_num);
+    if (!b_forest_set_payload(root->forest, payload_size)) {
+        hash_tree_free(root);
+        return NULL;
     }
     return root;
 }
 
-struct B_Tree *hash_find_b_tree(const Hash_Tree_Root *root, int key) {
+int hash_find_partition(const Hash_Tree_Root *root, int key) {
     int mod = root->b_tree_num;
     int b_tree_index = ((key % mod) + mod) % mod;
-    return root->b_tree_node[b_tree_index];
+    return b_tree_index;
 }
 
 void hash_tree_free(Hash_Tree_Root *root) {
-    for (int i = 0; i < root->b_tree_num; i++) {
-        b_tree_free(root->b_tree_node[i]);
-    }
-    free(root->b_tree_node);
+    b_forest_free(root->forest);
     free(root);
     root = NULL;
 }
 
 bool hash_tree_exist(const Hash_Tree_Root *root, int key) {
-    return b_tree_exist(hash_find_b_tree(root, key), key);
+    return b_forest_exist(root->forest, hash_find_partition(root, key), key);
 }
 
 void hash_tree_erase(const Hash_Tree_Root *root, int key) {
-    b_tree_erase(hash_find_b_tree(root, key), key);
+    b_forest_erase(root->forest, hash_find_partition(root, key), key);
 }
 
 void hash_tree_insert(const Hash_Tree_Root *root, int key, const char *s) {
-    b_tree_insert(hash_find_b_tree(root, key), key, s);
+    b_forest_insert(root->forest, hash_find_partition(root, key), key, s);
+}
+
+const char *hash_tree_upsert(const Hash_Tree_Root *root, int key, const char *s,
+                             bool *ok) {
+    return b_forest_upsert(root->forest, hash_find_partition(root, key), key, s, ok);
+}
+
+KV_Node *hash_tree_get_or_insert(const Hash_Tree_Root *root, int key,
+                               const char *s, bool *inserted) {
+    return b_forest_get_or_insert(root->forest, hash_find_partition(root, key),
+                                  key, s, inserted);
+}
+
+bool hash_tree_update(const Hash_Tree_Root *root, int key, KV_Update fn,
+                      void *udata) {
+    return b_forest_update(root->forest, hash_find_partition(root, key), key, fn,
+                           udata);
 }
 
 KV_Node *hash_tree_query(const Hash_Tree_Root *root, int key) {
-    return b_tree_query(hash_find_b_tree(root, key), key);
+    return b_forest_query(root->forest, hash_find_partition(root, key), key);
+}
+
+const char *hash_tree_value(const Hash_Tree_Root *root, const KV_Node *node) {
+    return b_forest_value(root->forest, node);
+}
+
+void hash_tree_insert_pod(const Hash_Tree_Root *root, int key,
+                          const void *val) {
+    b_forest_insert_pod(root->forest, hash_find_partition(root, key), key, val);
+}
+
+bool hash_tree_query_pod(const Hash_Tree_Root *root, int key, void *val) {
+    return b_forest_query_pod(root->forest, hash_find_partition(root, key), key,
+                              val);
 }
 
 void print_hash_tree_node(const Hash_Tree_Root *root, int key) {
-    print_kv_node(hash_find_b_tree(root, key));
+    KV_Node *node = hash_tree_query(root, key);
+    print_kv_node(node, hash_tree_value(root, node));
 }
\ No newline at end of file
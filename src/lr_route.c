@@ -0,0 +1,274 @@
+#include "../inc/lr_route.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+void lr_route_init(LR_Route *route, const int *endpoint, int n) {
+    route->mode = LR_ROUTE_BISECT;
+    route->n = n;
+    route->endpoint = endpoint;
+    route->stage_num = 0;
+    for (int i = 0; i < MAX_LAYER; i++) {
+        route->fanout[i] = 0;
+        route->stage[i] = NULL;
+    }
+    route->eytz = route->eytz_idx = NULL;
+    route->block_num = 0;
+    route->block = route->block_idx = NULL;
+}
+
+// 在arr[l, r]中二分找到第一个大于等于key的下标, 都小于key时返回r
+static int lr_route_bisect(const int *arr, int l, int r, int key) {
+    while (l < r) {
+        int mid = (l + r) >> 1;
+        if (arr[mid] >= key) {
+            r = mid;
+        } else {
+            l = mid + 1;
+        }
+    }
+    return l;
+}
+
+// 模型预测的下标, 截断到[0, n - 1]
+static inline int lr_route_predict(const LR_Route_Model *model, int key,
+                                   int n) {
+    double pos = model->k * key + model->b;
+    if (pos < 0.0)
+        return 0;
+    if (pos >= n)
+        return n - 1;
+    return (int)pos;
+}
+
+void lr_route_build_rmi(LR_Route *route, int stage_num, const int *fanout) {
+    assert(stage_num >= 1 && stage_num < MAX_LAYER);
+    lr_route_free(route);
+    const int *e = route->endpoint;
+    int n = route->n;
+    route->stage_num = stage_num;
+    route->fanout[0] = 1;
+    for (int s = 1; s < stage_num; s++) {
+        assert(fanout[s - 1] > 0);
+        route->fanout[s] = fanout[s - 1];
+    }
+    // 每个模型分到的是endpoint中连续的一段[start[m], start[m + 1])
+    int max_fanout = 1;
+    for (int s = 1; s < stage_num; s++) {
+        if (route->fanout[s] > max_fanout)
+            max_fanout = route->fanout[s];
+    }
+    int *start = (int *)malloc((max_fanout + 1) * sizeof(int));
+    int *next = (int *)malloc((max_fanout + 1) * sizeof(int));
+    start[0] = 0, start[1] = n;
+    for (int s = 0; s < stage_num; s++) {
+        int m_num = route->fanout[s];
+        route->stage[s] =
+            (LR_Route_Model *)malloc(m_num * sizeof(LR_Route_Model));
+        int m_next = (s + 1 < stage_num) ? route->fanout[s + 1] : 0;
+        int cur = 0; // 下一层的模型分配进度
+        for (int m = 0; m < m_num; m++) {
+            LR_Route_Model *model = &route->stage[s][m];
+            int lo = start[m], cnt = start[m + 1] - start[m];
+            // 拟合(endpoint, 段内rank)点对, 再平移到全局下标
+            sample_linear_fitting(e + lo, cnt, &model->k, &model->b, cnt);
+            if (model->k < 0.0)
+                model->k = 0.0; // 保证预测关于key单调
+            model->b += lo;
+            model->lo = (lo < n) ? lo : n - 1;
+            model->hi = (lo + cnt < n) ? lo + cnt : n - 1;
+            if (!m_next)
+                continue;
+            // 按预测下标将本段的endpoint划分给下一层的模型
+            for (int i = lo; i < lo + cnt; i++) {
+                long long sub =
+                    (long long)lr_route_predict(model, e[i], n) * m_next / n;
+                while (cur <= sub)
+                    next[cur++] = i;
+            }
+        }
+        if (m_next) {
+            while (cur <= m_next)
+                next[cur++] = n;
+            int *tmp = start;
+            start = next, next = tmp;
+        }
+    }
+    free(start);
+    free(next);
+    route->mode = LR_ROUTE_RMI;
+}
+
+// 逐级预测, 再从预测位置出发在[lo, hi]内做指数搜索修正
+static int lr_route_find_rmi(const LR_Route *route, int key) {
+    const int *e = route->endpoint;
+    int n = route->n;
+    const LR_Route_Model *model = &route->stage[0][0];
+    for (int s = 1; s < route->stage_num; s++) {
+        long long m =
+            (long long)lr_route_predict(model, key, n) * route->fanout[s] / n;
+        model = &route->stage[s][m];
+    }
+    int lo = model->lo, hi = model->hi;
+    int pos = lr_route_predict(model, key, n);
+    if (pos < lo)
+        pos = lo;
+    else if (pos > hi)
+        pos = hi;
+    int step = 1, l, r;
+    if (e[pos] >= key) {
+        // 答案在[lo, pos]之内, 向左倍增直到遇到小于key的位置
+        r = pos;
+        while (1) {
+            l = r - step;
+            if (l <= lo) {
+                l = lo;
+                break;
+            }
+            if (e[l] < key)
+                break;
+            r = l;
+            step <<= 1;
+        }
+        return lr_route_bisect(e, l, r, key);
+    }
+    if (pos == hi)
+        return hi;
+    // 答案在(pos, hi]之内, 向右倍增直到遇到大于等于key的位置
+    l = pos + 1;
+    while (1) {
+        r = l + step - 1;
+        if (r >= hi) {
+            r = hi;
+            break;
+        }
+        if (e[r] >= key)
+            break;
+        l = r + 1;
+        step <<= 1;
+    }
+    return lr_route_bisect(e, l, r, key);
+}
+
+// 中序遍历以BFS编号的完全二叉树, 依次填入有序的endpoint
+static int lr_route_eytz_fill(LR_Route *route, int k, int t) {
+    if (k <= route->n) {
+        t = lr_route_eytz_fill(route, 2 * k, t);
+        route->eytz[k] = route->endpoint[t];
+        route->eytz_idx[k] = t++;
+        t = lr_route_eytz_fill(route, 2 * k + 1, t);
+    }
+    return t;
+}
+
+// 中序遍历(SIMD_WIDTH + 1)叉的隐式树, 依次填入有序的endpoint
+static int lr_route_block_fill(LR_Route *route, int k, int t) {
+    if (k < route->block_num) {
+        for (int i = 0; i < SIMD_WIDTH; i++) {
+            t = lr_route_block_fill(route, k * (SIMD_WIDTH + 1) + i + 1, t);
+            int slot = k * SIMD_WIDTH + i;
+            // 填充位只会在key大于所有endpoint时被选中, 此时答案为n - 1
+            route->block[slot] = (t < route->n) ? route->endpoint[t] : INT_MAX;
+            route->block_idx[slot] = (t < route->n) ? t : route->n - 1;
+            t++;
+        }
+        t = lr_route_block_fill(route, k * (SIMD_WIDTH + 1) + SIMD_WIDTH + 1,
+                                t);
+    }
+    return t;
+}
+
+void lr_route_build(LR_Route *route, LR_Route_Mode mode) {
+    lr_route_free(route);
+    int n = route->n;
+    if (mode == LR_ROUTE_RMI) {
+        // 默认两层: 根模型 + 平均每个模型负责8个endpoint的第二层
+        int fanout = (n + 7) / 8;
+        lr_route_build_rmi(route, 2, &fanout);
+    } else if (mode == LR_ROUTE_EYTZINGER) {
+        size_t size = (n + 1) * sizeof(int);
+        route->eytz = (int *)aligned_malloc(size);
+        route->eytz_idx = (int *)aligned_malloc(size);
+        lr_route_eytz_fill(route, 1, 0);
+        route->mode = mode;
+    } else if (mode == LR_ROUTE_SIMD) {
+        route->block_num = (n + SIMD_WIDTH - 1) / SIMD_WIDTH;
+        size_t size = (size_t)route->block_num * SIMD_WIDTH * sizeof(int);
+        route->block = (int *)aligned_malloc(size);
+        route->block_idx = (int *)aligned_malloc(size);
+        lr_route_block_fill(route, 0, 0);
+        route->mode = mode;
+    }
+}
+
+// 每层只做一次比较并用比较结果计算子节点下标, 同时预取4层之后的节点
+// (预取只是提示, 越过数组末尾的地址不会引发访存错误)
+static int lr_route_find_eytz(const LR_Route *route, int key) {
+    const int *t = route->eytz;
+    int n = route->n;
+    unsigned k = 1;
+    while (k <= (unsigned)n) {
+        __builtin_prefetch(t + k * (CACHE_LINE / sizeof(int)));
+        k = 2 * k + (t[k] < key);
+    }
+    // 去掉最后若干次"向右"的移动, 回到最后一次向左时的节点
+    k >>= __builtin_ffs(~(int)k);
+    return k ? route->eytz_idx[k] : n - 1;
+}
+
+// 统计块内小于key的endpoint个数, 即应进入的子树编号
+static inline int lr_route_block_rank(const int *blk, int key) {
+#ifdef __AVX2__
+    __m256i v = _mm256_load_si256((const __m256i *)blk);
+    __m256i lt = _mm256_cmpgt_epi32(_mm256_set1_epi32(key), v);
+    return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+#else
+    int rank = 0;
+    for (int i = 0; i < SIMD_WIDTH; i++)
+        rank += (blk[i] < key);
+    return rank;
+#endif
+}
+
+static int lr_route_find_simd(const LR_Route *route, int key) {
+    int ans = route->n - 1;
+    int k = 0;
+    while (k < route->block_num) {
+        const int *blk = route->block + k * SIMD_WIDTH;
+        int i = lr_route_block_rank(blk, key);
+        if (i < SIMD_WIDTH)
+            ans = route->block_idx[k * SIMD_WIDTH + i];
+        k = k * (SIMD_WIDTH + 1) + i + 1;
+    }
+    return ans;
+}
+
+int lr_route_find(const LR_Route *route, int key) {
+    switch (route->mode) {
+    case LR_ROUTE_RMI:
+        return lr_route_find_rmi(route, key);
+    case LR_ROUTE_EYTZINGER:
+        return lr_route_find_eytz(route, key);
+    case LR_ROUTE_SIMD:
+        return lr_route_find_simd(route, key);
+    default:
+        return lr_route_bisect(route->endpoint, 0, route->n - 1, key);
+    }
+}
+
+void lr_route_free(LR_Route *route) {
+    for (int i = 0; i < MAX_LAYER; i++) {
+        free(route->stage[i]);
+        route->stage[i] = NULL;
+        route->fanout[i] = 0;
+    }
+    route->stage_num = 0;
+    aligned_free(route->eytz);
+    aligned_free(route->eytz_idx);
+    aligned_free(route->block);
+    aligned_free(route->block_idx);
+    route->eytz = route->eytz_idx = NULL;
+    route->block_num = 0;
+    route->block = route->block_idx = NULL;
+    route->mode = LR_ROUTE_BISECT;
+}
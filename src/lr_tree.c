@@ -1,123 +1,839 @@
 #include "../inc/lr_tree.h"
 
-LR_Tree_Root *lr_tree_create(double mean, double sigma, int branch,
-                             int b_tree_num, int left, int right) {
-    // 本次递归创建的线性回归树节点
+// 并行构建时单个线程的任务, 负责叶子区间[begin, end)
+typedef struct LR_Tree_Build_Task {
+    LR_Tree_Root shadow;      // 根节点的浅拷贝, 样条节点先写入线程私有的节点池
+    const Distribution *dist; // 用于划分和拟合的分布
+    int begin, end;           // 负责的叶子下标区间
+    bool fit;                 // 为false时只求右端点, 为true时拟合叶子
+} LR_Tree_Build_Task;
+
+// 分配根节点、叶子数组和全局B树森林, 叶子的拟合参数和端点由调用方填写, B树在第一次插入时才分配节点
+static LR_Tree_Root *lr_tree_alloc(int branch, int b_tree_num, int left,
+                                   int right) {
     LR_Tree_Root *root = (LR_Tree_Root *)malloc(sizeof(LR_Tree_Root));
     root->left = left, root->right = right; // key值左右范围
     root->leaf_num = branch; // 根节点下连接多少叶子节点
-    // 记录每一个叶子节点的指针
-    root->leaf_node = (LR_Tree_Leaf **)malloc(branch * sizeof(LR_Tree_Leaf *));
-    // 基于正态分布的累积分布函数求出按概率均分之后每一段的右端点
-    root->right_endpoint = (int *)malloc(branch * sizeof(int));
+    root->b_tree_total = branch * b_tree_num;
+    root->fixed = NULL;
+    root->hint = true;
+    root->knot = NULL;
+    root->knot_num = root->knot_cap = 0;
+    root->right_endpoint = (int *)aligned_malloc(branch * sizeof(int));
+    root->leaf = (LR_Tree_Leaf *)aligned_malloc(branch * sizeof(LR_Tree_Leaf));
+    root->forest = b_forest_create(root->b_tree_total);
     for (int i = 0; i < branch; i++) {
-        double cdf_val = ((double)i + 1.0) / (double)branch;
-        long long x;
-        if (1.0 - cdf_val > EPSILON)
-            x = normal_icdf(mean, sigma, cdf_val);
-        else
-            x = INT_MAX - 1;
-        if (x >= INT_MAX)
-            root->right_endpoint[i] = INT_MAX - 1;
-        else if (x <= INT_MIN)
-            root->right_endpoint[i] = INT_MIN + 1;
+        LR_Tree_Leaf *leaf = &root->leaf[i];
+        leaf->k = 0.0, leaf->b = 0.0;
+        leaf->knot = -1;
+        leaf->base = i * b_tree_num;
+        leaf->b_tree_num = b_tree_num;
+    }
+    return root;
+}
+
+// 求按概率均分之后第i段的右端点, 相邻端点的严格递增由调用方修正
+static int lr_tree_endpoint(const Distribution *dist, int i, int branch) {
+    double cdf_val = ((double)i + 1.0) / (double)branch;
+    double x;
+    if (1.0 - cdf_val > EPSILON)
+        x = dist_icdf(dist, cdf_val);
+    else
+        x = INT_MAX - 1;
+    if (x >= INT_MAX)
+        return INT_MAX - 1;
+    if (x <= INT_MIN)
+        return INT_MIN + 1;
+    return (int)x;
+}
+
+// 从样条节点池中分配num个连续节点, 返回起始下标
+static int lr_tree_knot_reserve(LR_Tree_Root *root, int num) {
+    if (root->knot_num + num > root->knot_cap) {
+        int cap = root->knot_cap ? root->knot_cap : 64 * SPLINE_KNOT;
+        while (cap < root->knot_num + num)
+            cap *= 2;
+        LR_Tree_Knot *knot =
+            (LR_Tree_Knot *)aligned_malloc(cap * sizeof(LR_Tree_Knot));
+        if (root->knot_num)
+            memcpy(knot, root->knot, root->knot_num * sizeof(LR_Tree_Knot));
+        aligned_free(root->knot);
+        root->knot = knot;
+        root->knot_cap = cap;
+    }
+    int offset = root->knot_num;
+    root->knot_num += num;
+    return offset;
+}
+
+static void *lr_tree_build_worker(void *arg) {
+    LR_Tree_Build_Task *task = (LR_Tree_Build_Task *)arg;
+    LR_Tree_Root *root = &task->shadow;
+    for (int i = task->begin; i < task->end; i++) {
+        if (task->fit) {
+            lr_tree_leaf_fit(root, i, task->dist);
+        } else {
+            root->right_endpoint[i] =
+                lr_tree_endpoint(task->dist, i, root->leaf_num);
+        }
+    }
+    return NULL;
+}
+
+// 将叶子均分给若干线程执行同一构建阶段, 再按叶子顺序合并各线程的样条节点
+static void lr_tree_build_parallel(LR_Tree_Root *root, const Distribution *dist,
+                                   bool fit) {
+    int thread_num = cpu_count();
+    if (thread_num > BUILD_THREAD_MAX)
+        thread_num = BUILD_THREAD_MAX;
+    if (thread_num > root->leaf_num / BUILD_LEAF_PER_THREAD)
+        thread_num = root->leaf_num / BUILD_LEAF_PER_THREAD;
+    if (thread_num < 1)
+        thread_num = 1;
+    LR_Tree_Build_Task task[BUILD_THREAD_MAX];
+    pthread_t thread[BUILD_THREAD_MAX];
+    bool spawned[BUILD_THREAD_MAX];
+    for (int t = 0; t < thread_num; t++) {
+        task[t].shadow = *root;
+        task[t].shadow.knot = NULL;
+        task[t].shadow.knot_num = task[t].shadow.knot_cap = 0;
+        task[t].dist = dist;
+        task[t].begin = (int)((long long)root->leaf_num * t / thread_num);
+        task[t].end = (int)((long long)root->leaf_num * (t + 1) / thread_num);
+        task[t].fit = fit;
+    }
+    // 第0个任务由当前线程执行, 线程创建失败时同样退化为当前线程执行
+    for (int t = 1; t < thread_num; t++) {
+        spawned[t] = pthread_create(&thread[t], NULL, lr_tree_build_worker,
+                                    &task[t]) == 0;
+    }
+    lr_tree_build_worker(&task[0]);
+    for (int t = 1; t < thread_num; t++) {
+        if (spawned[t])
+            pthread_join(thread[t], NULL);
         else
-            root->right_endpoint[i] = (int)x;
+            lr_tree_build_worker(&task[t]);
+    }
+    for (int t = 0; t < thread_num; t++) {
+        int num = task[t].shadow.knot_num;
+        if (num == 0)
+            continue;
+        int offset = lr_tree_knot_reserve(root, num);
+        memcpy(root->knot + offset, task[t].shadow.knot,
+               num * sizeof(LR_Tree_Knot));
+        for (int i = task[t].begin; i < task[t].end; i++) {
+            if (root->leaf[i].knot >= 0)
+                root->leaf[i].knot += offset;
+        }
+        aligned_free(task[t].shadow.knot);
+    }
+}
+
+// 以叶子模型和分布的累积分布函数求出每个B树的概率质量, 乘以expected作为该B树的预期元素数,
+// 据此为其选择节点容量; 叶子内第j个B树负责模型预测值落在[j, j + 1)内的key值段,
+// 预测值被截断的两端分别计入叶子的首尾两个B树. 模型单调, 段的分界以二分求出
+static void lr_tree_model_fanout(LR_Tree_Root *root, const Distribution *dist,
+                                 int expected) {
+    for (int i = 0; i < root->leaf_num; i++) {
+        const LR_Tree_Leaf *leaf = &root->leaf[i];
+        long long lo = leaf->left, hi = root->right_endpoint[i];
+        double begin = dist_cdf(dist, (double)lo);
+        for (int j = 0; j < leaf->b_tree_num; j++) {
+            int p = leaf->base + j;
+            double end;
+            if (j == leaf->b_tree_num - 1) {
+                end = dist_cdf(dist, (double)hi + 1.0);
+            } else {
+                // 在[lo, hi + 1]中找到第一个预测为后续B树的key
+                long long l = lo, r = hi + 1;
+                while (l < r) {
+                    long long mid = l + (r - l) / 2;
+                    if (lr_tree_find_partition(root, (int)mid) > p)
+                        r = mid;
+                    else
+                        l = mid + 1;
+                }
+                lo = l;
+                end = dist_cdf(dist, (double)l);
+            }
+            double items = (end - begin) * expected;
+            begin = end;
+            b_forest_set_max_items(
+                root->forest, p,
+                b_tree_fit_max_items((size_t)(items + 0.5),
+                                     root->forest->elsize));
+        }
+    }
+}
+
+LR_Tree_Root *lr_tree_create(double mean, double sigma, int branch,
+                             int b_tree_num, int left, int right,
+                             LR_Route_Mode route_mode, int expected) {
+    Distribution dist = dist_gaussian(mean, sigma);
+    return lr_tree_create_dist(&dist, branch, b_tree_num, left, right,
+                               route_mode, expected);
+}
+
+LR_Tree_Root *lr_tree_create_dist(const Distribution *dist, int branch,
+                                  int b_tree_num, int left, int right,
+                                  LR_Route_Mode route_mode, int expected) {
+    LR_Tree_Root *root = lr_tree_alloc(branch, b_tree_num, left, right);
+    // 基于分布的累积分布函数并行求出按概率均分之后每一段的右端点
+    lr_tree_build_parallel(root, dist, false);
+    for (int i = 1; i < branch; i++) {
+        // 分布高度集中时相邻分位点可能取整到同一个值, 保证右端点严格递增
+        if (root->right_endpoint[i] <= root->right_endpoint[i - 1])
+            root->right_endpoint[i] = root->right_endpoint[i - 1] + 1;
     }
     root->right_endpoint[branch - 1] = INT_MAX - 1; // 最后一个分段进行兜底
+    for (int i = 1; i < branch; i++) {
+        // 确保每个区间都有至少一个数
+        assert(root->right_endpoint[i] > root->right_endpoint[i - 1]);
+    }
+    lr_route_init(&root->route, root->right_endpoint, branch);
+    lr_route_build(&root->route, route_mode);
+    // 各叶子的拟合互不依赖, 并行拟合
+    lr_tree_build_parallel(root, dist, true);
+    if (expected > 0)
+        lr_tree_model_fanout(root, dist, expected);
+    return root;
+}
+
+// 在样条节点上线性插值求B树预测值, 节点范围之外取端点值
+static inline double lr_tree_spline_eval(const LR_Tree_Knot *knot, int key) {
+    if (key <= knot[0].x)
+        return knot[0].y;
+    if (key >= knot[SPLINE_KNOT - 1].x)
+        return knot[SPLINE_KNOT - 1].y;
+    // 节点数固定且同在一个缓存行内, 无分支地数出key所在的段[j - 1, j]
+    int j = 1;
+    for (int i = 1; i < SPLINE_KNOT - 1; i++)
+        j += knot[i].x < key;
+    double dx = (double)knot[j].x - knot[j - 1].x;
+    return knot[j - 1].y +
+           (knot[j].y - knot[j - 1].y) * ((double)key - knot[j - 1].x) / dx;
+}
+
+// 直线模型误差过大且样条模型误差更小时, 将样条节点存入节点池并标记到叶子上
+static void lr_tree_leaf_choose(LR_Tree_Root *root, LR_Tree_Leaf *leaf,
+                                const LR_Tree_Knot *knot, double line_err,
+                                double spline_err) {
+    leaf->knot = -1;
+    if (line_err <= SPLINE_MIN_ERROR || spline_err >= line_err)
+        return;
+    leaf->knot = lr_tree_knot_reserve(root, SPLINE_KNOT);
+    memcpy(root->knot + leaf->knot, knot, SPLINE_KNOT * sizeof(LR_Tree_Knot));
+}
+
+void lr_tree_leaf_fit(LR_Tree_Root *root, int i, const Distribution *dist) {
+    LR_Tree_Leaf *leaf = &root->leaf[i];
+    int left = (i == 0) ? (INT_MIN + 1) : (root->right_endpoint[i - 1] + 1);
+    int right = root->right_endpoint[i];
+    int base = leaf->b_tree_num;
+    leaf->left = left;
+    leaf->knot = -1;
+    leaf->k = leaf->b = 0.0;
+    if (base == 1)
+        return; // 只有一颗B树时任何预测值都会被截断为0, 无需拟合
+    // 基于最小二乘给出拟合[left, right]段的直线参数
+    dist_linear_fitting(dist, left, right, &leaf->k, &leaf->b, base);
+    // 此时使用y = k * x + b拟合分布函数CDF的x = [left, right]段
+    // 而y值落在[0, b_tree_num)之上
+    double y0 = dist_cdf(dist, (double)left);
+    double y1 = dist_cdf(dist, (double)right);
+    if (y1 - y0 < EPSILON)
+        return; // 概率质量可忽略时直线即为均匀划分, 无需样条
+    // 样条节点按概率等分地取在首末两颗B树的中点之间, 节点处的预测值即为精确的分位;
+    // 首末节点不取在left和right上, 否则重尾叶子的首末段过宽, 两端的B树几乎分不到key
+    LR_Tree_Knot knot[SPLINE_KNOT];
+    double line_err = 0.0;
+    for (int j = 0; j < SPLINE_KNOT; j++) {
+        double t = (0.5 + (double)j * (base - 1) / (SPLINE_KNOT - 1)) / base;
+        double x = dist_icdf(dist, y0 + t * (y1 - y0));
+        x = fmin(fmax(x, (double)left), (double)right);
+        knot[j].x = (int)floor(x);
+        if (j && knot[j].x < knot[j - 1].x)
+            knot[j].x = knot[j - 1].x;
+        knot[j].y = (float)(t * base);
+        line_err = fmax(line_err, fabs(leaf->k * x + leaf->b - t * base));
+    }
+    // 直线在各节点处的误差已足够小时, 不再逐点探测, 大多数叶子在此返回
+    if (line_err <= SPLINE_MIN_ERROR / 2)
+        return;
+    // 在按概率等分的探测点上比较两种模型的最大误差
+    double width = (double)right - (double)left + 1.0;
+    int probe_num = (width > SPLINE_PROBE) ? SPLINE_PROBE : (int)width;
+    double spline_err = 0.0;
+    for (int p = 0; p < probe_num; p++) {
+        double t = (p + 0.5) / probe_num;
+        double x = dist_icdf(dist, y0 + t * (y1 - y0));
+        x = fmin(fmax(x, (double)left), (double)right);
+        double y = t * base;
+        line_err = fmax(line_err, fabs(leaf->k * x + leaf->b - y));
+        spline_err =
+            fmax(spline_err, fabs(lr_tree_spline_eval(knot, (int)x) - y));
+    }
+    lr_tree_leaf_choose(root, leaf, knot, line_err, spline_err);
+}
+
+// 以落在叶子内的有序样本拟合该叶子, 同样按探测误差在直线与样条模型中择优
+// cum为NULL时每个样本权重为1, 否则cum[0..n]为这些样本的累计权重
+static void lr_tree_leaf_fit_keys(LR_Tree_Root *root, LR_Tree_Leaf *leaf,
+                                  const int *keys, const double *cum, int n) {
+    int base = leaf->b_tree_num;
+    // 直接以真实的(key, 累计权重)点对拟合, 使每个B树分得的权重接近
+    if (cum)
+        weighted_linear_fitting(keys, cum, n, &leaf->k, &leaf->b, base);
+    else
+        sample_linear_fitting(keys, n, &leaf->k, &leaf->b, base);
+    leaf->knot = -1;
+    if (n < SPLINE_KNOT)
+        return;
+#define LEAF_MASS(r) (cum ? cum[r] - cum[0] : (double)(r))
+    double total = LEAF_MASS(n);
+    if (total <= 0.0)
+        return;
+    // 样条节点取在等间隔的累计权重上
+    LR_Tree_Knot knot[SPLINE_KNOT];
+    int r = 0;
+    for (int j = 0; j < SPLINE_KNOT; j++) {
+        double target = LEAF_MASS(n - 1) * j / (SPLINE_KNOT - 1);
+        while (r < n - 1 && LEAF_MASS(r + 1) <= target)
+            r++;
+        knot[j].x = keys[r];
+        knot[j].y = (float)(LEAF_MASS(r) * base / total);
+    }
+    int stride = (n > SPLINE_PROBE) ? n / SPLINE_PROBE : 1;
+    double line_err = 0.0, spline_err = 0.0;
+    for (r = stride / 2; r < n; r += stride) {
+        double y = LEAF_MASS(r) * base / total;
+        line_err = fmax(line_err, fabs(leaf->k * keys[r] + leaf->b - y));
+        spline_err = fmax(spline_err,
+                          fabs(lr_tree_spline_eval(knot, keys[r]) - y));
+    }
+#undef LEAF_MASS
+    lr_tree_leaf_choose(root, leaf, knot, line_err, spline_err);
+}
+
+// 右端点已填好后, 建立路由表, 并以落在各叶子内的有序样本拟合叶子
+static void lr_tree_fit_sorted(LR_Tree_Root *root, const int *sorted,
+                               const double *cum, int n,
+                               LR_Route_Mode route_mode) {
+    lr_route_init(&root->route, root->right_endpoint, root->leaf_num);
+    lr_route_build(&root->route, route_mode);
+    int lo = 0; // 当前叶子的第一个样本下标
+    for (int i = 0; i < root->leaf_num; i++) {
+        LR_Tree_Leaf *leaf = &root->leaf[i];
+        leaf->left =
+            (i == 0) ? root->left : (root->right_endpoint[i - 1] + 1);
+        // 端点修正后以实际落在[left, right]内的样本为准
+        int hi = lo;
+        while (hi < n && sorted[hi] <= root->right_endpoint[i])
+            hi++;
+        lr_tree_leaf_fit_keys(root, leaf, sorted + lo, cum ? cum + lo : NULL,
+                              hi - lo);
+        lo = hi;
+    }
+    // 样本即模型所依据的经验分布, 各B树的概率质量对应的预期元素数就是落入其中的样本数
+    lr_tree_tune_fanout(root, sorted, n);
+}
+
+LR_Tree_Root *lr_tree_create_from_keys(const int *sorted, int n, int branch,
+                                       int b_tree_num, int left, int right,
+                                       LR_Route_Mode route_mode) {
+    assert(n > 0 && branch > 0);
+    LR_Tree_Root *root = lr_tree_alloc(branch, b_tree_num, left, right);
+    // 每个叶子负责的样本在sorted中的起始下标, 即按经验分位数划分
+    int *start = (int *)malloc((branch + 1) * sizeof(int));
+    for (int i = 0; i <= branch; i++) {
+        start[i] = (int)((long long)n * i / branch);
+    }
     for (int i = 0; i < branch; i++) {
-        // 为根节点分配出若干叶子节点
-        if (i) {
-            // 确保每个区间都有至少一个数
-            assert(root->right_endpoint[i] > root->right_endpoint[i - 1]);
+        int x;
+        if (i == branch - 1)
+            x = right; // 最后一个分段进行兜底
+        else if (start[i + 1] > 0)
+            x = sorted[start[i + 1] - 1]; // 该段最后一个样本即为右端点
+        else
+            x = left;
+        // 样本不足或存在重复key时, 保证右端点严格递增
+        if (i && x <= root->right_endpoint[i - 1])
+            x = root->right_endpoint[i - 1] + 1;
+        root->right_endpoint[i] = x;
+    }
+    free(start);
+    lr_tree_fit_sorted(root, sorted, NULL, n, route_mode);
+    return root;
+}
+
+LR_Tree_Root *lr_tree_create_weighted(const int *keys, const double *weight,
+                                      int n, int branch, int b_tree_num,
+                                      int left, int right,
+                                      LR_Route_Mode route_mode) {
+    assert(n > 0 && branch > 0);
+    LR_Tree_Root *root = lr_tree_alloc(branch, b_tree_num, left, right);
+    double *cum = (double *)malloc((n + 1) * sizeof(double));
+    cum[0] = 0.0;
+    for (int i = 0; i < n; i++) {
+        assert(weight[i] >= 0.0);
+        cum[i + 1] = cum[i] + weight[i];
+    }
+    // 按累计权重等分求右端点: 第i段以累计权重首次达到(i + 1) / branch的样本结尾
+    int j = 0;
+    for (int i = 0; i < branch; i++) {
+        int x = right; // 最后一个分段进行兜底
+        if (i < branch - 1) {
+            double target = cum[n] * (i + 1) / branch;
+            while (j < n - 1 && cum[j + 1] < target)
+                j++;
+            x = keys[j];
         }
-        int leaf_left =
-            (i == 0) ? (INT_MIN + 1) : (root->right_endpoint[i - 1] + 1);
-        int leaf_right = root->right_endpoint[i];
-        // printf("[%d, %d]\n", leaf_left, leaf_right);
-        root->leaf_node[i] =
-            lr_tree_leaf_create(mean, sigma, b_tree_num, leaf_left, leaf_right);
+        // 单个key的权重超过1 / branch时会连续落在同一端点上, 保证右端点严格递增
+        if (i && x <= root->right_endpoint[i - 1])
+            x = root->right_endpoint[i - 1] + 1;
+        root->right_endpoint[i] = x;
     }
+    lr_tree_fit_sorted(root, keys, cum, n, route_mode);
+    free(cum);
     return root;
 }
 
-LR_Tree_Leaf *lr_tree_leaf_create(double mean, double sigma, int b_tree_num,
-                                  int left, int right) {
-    LR_Tree_Leaf *leaf = (LR_Tree_Leaf *)malloc(sizeof(LR_Tree_Leaf));
-    leaf->left = left, leaf->right = right;
-    leaf->b_tree_num = b_tree_num;
-    // 基于最小二乘给出拟合[left, right]段的直线参数
-    linear_fitting(mean, sigma, left, right, &leaf->k, &leaf->b, b_tree_num);
-    // 此时使用y = k * x + b拟合正态分布函数CDF的x = [left, right]段
-    // 而y值落在[0, b_tree_num - 1]之上
-    leaf->b_tree_node = (struct B_Tree**)malloc(b_tree_num * sizeof(struct B_Tree*));
-    for(int i = 0; i < b_tree_num; i ++){
-        // 为该叶子节点赋予b_tree_num个B树子节点
-        leaf->b_tree_node[i] = b_tree_create();
-    }
-    return leaf;
-}
-
-struct B_Tree *find_b_tree(const LR_Tree_Root *root, int key){
-    // 基于二分选中对应的叶子节点分支
-    int*arr = root->right_endpoint;
-    int n = root->leaf_num;// 叶子的数量
-    int l = 0, r = n - 1;
-    // 通过二分找到第一个存储大于等于key值的right_endpoint数组值的索引
-    while(l < r){
-        int mid = (l + r) >> 1;
-        if(arr[mid] >= key){
-            r = mid;
-        }else{
-            l = mid + 1;
+LR_Tree_Root *lr_tree_create_workload(const int *sorted, int n,
+                                      const int *trace, int m, double alpha,
+                                      int branch, int b_tree_num, int left,
+                                      int right, LR_Route_Mode route_mode) {
+    assert(n > 0 && alpha >= 0.0 && alpha <= 1.0);
+    if (m <= 0)
+        alpha = 0.0;
+    int *query = (int *)malloc((m > 0 ? m : 1) * sizeof(int));
+    if (m > 0)
+        memcpy(query, trace, m * sizeof(int));
+    if (m > 1)
+        quick_sort(query, 0, m - 1);
+    // 归并两个有序数组并合并相同的key, 每次出现分别贡献(1 - alpha) / n与alpha / m
+    int *keys = (int *)malloc((n + m) * sizeof(int));
+    double *weight = (double *)malloc((n + m) * sizeof(double));
+    int cnt = 0;
+    for (int i = 0, j = 0; i < n || j < m;) {
+        bool from_data = j >= m || (i < n && sorted[i] <= query[j]);
+        int key = from_data ? sorted[i] : query[j];
+        double w = from_data ? (1.0 - alpha) / n : alpha / m;
+        if (from_data)
+            i++;
+        else
+            j++;
+        if (cnt && keys[cnt - 1] == key) {
+            weight[cnt - 1] += w;
+        } else {
+            keys[cnt] = key;
+            weight[cnt++] = w;
         }
     }
-    LR_Tree_Leaf* leaf = root->leaf_node[l];// 取出二分到的叶子节点指针
-    // 根据拟合公式计算出是哪一个B树
-    int b_tree_index = (int)(leaf->k * key + leaf->b);
-    if(b_tree_index >= leaf->b_tree_num) b_tree_index = leaf->b_tree_num - 1;
-    else if(b_tree_index < 0) b_tree_index = 0;
-    return leaf->b_tree_node[b_tree_index];
+    LR_Tree_Root *root = lr_tree_create_weighted(
+        keys, weight, cnt, branch, b_tree_num, left, right, route_mode);
+    // 查询轨迹中的key并不存放在树中, 节点容量只按数据key的数量选择
+    if (m > 0)
+        lr_tree_tune_fanout(root, sorted, n);
+    free(query);
+    free(keys);
+    free(weight);
+    return root;
 }
 
-void lr_tree_free(LR_Tree_Root *root){
-    int n = root->leaf_num;
-    for(int i = 0; i < n; i ++){
-        LR_Tree_Leaf* leaf = root->leaf_node[i];
-        int m = leaf->b_tree_num;
-        for(int j = 0; j < m; j ++){
-            // 释放每个叶子的所有B树内存
-            b_tree_free(leaf->b_tree_node[j]);
+LR_Tree_Root *lr_tree_create_histogram(const int *sorted, int n,
+                                       const int *bucket_right,
+                                       const double *freq, int bucket_num,
+                                       double alpha, int branch,
+                                       int b_tree_num, int left, int right,
+                                       LR_Route_Mode route_mode) {
+    assert(n > 0 && alpha >= 0.0 && alpha <= 1.0);
+    // 每个样本所在的桶, 超出最后一个桶的样本记为bucket_num(不分摊访问频率)
+    int *bucket = (int *)malloc(n * sizeof(int));
+    int *count = (int *)calloc(bucket_num + 1, sizeof(int));
+    for (int i = 0, t = 0; i < n; i++) {
+        while (t < bucket_num && sorted[i] > bucket_right[t])
+            t++;
+        bucket[i] = t;
+        count[t]++;
+    }
+    // 只统计有样本落入的桶的频率, 没有样本的桶无法分摊
+    double freq_sum = 0.0;
+    for (int t = 0; t < bucket_num; t++) {
+        if (count[t])
+            freq_sum += freq[t];
+    }
+    if (freq_sum <= 0.0)
+        alpha = 0.0;
+    double *weight = (double *)malloc(n * sizeof(double));
+    for (int i = 0; i < n; i++) {
+        int t = bucket[i];
+        weight[i] = (1.0 - alpha) / n;
+        if (alpha > 0.0 && t < bucket_num)
+            weight[i] += alpha * freq[t] / (freq_sum * count[t]);
+    }
+    LR_Tree_Root *root = lr_tree_create_weighted(
+        sorted, weight, n, branch, b_tree_num, left, right, route_mode);
+    free(bucket);
+    free(count);
+    free(weight);
+    return root;
+}
+
+void lr_tree_build_rmi(LR_Tree_Root *root, int layer, const int *fanout){
+    // 叶子节点本身即为最后一层模型, 其上的layer - 1层模型负责预测叶子下标
+    lr_route_build_rmi(&root->route, layer - 1, fanout);
+}
+
+// 将叶子节点的double模型转换为定点整数模型
+static void lr_tree_fixed_fit(LR_Tree_Fixed *f, const LR_Tree_Leaf *leaf,
+                              int right){
+    f->base = leaf->base;
+    f->b_tree_num = leaf->b_tree_num;
+    if(leaf->knot >= 0){
+        // 样条叶子没有对应的直线, 路由时仍走样条插值
+        f->mult = f->c = 0;
+        f->origin = 0;
+        f->shift = -1;
+        return;
+    }
+    // 以left为原点; 若直线零点在left右侧, 则改以零点为原点,
+    // 零点左侧的key预测值为负, 与double版本一样会被截断为0
+    double origin = leaf->left;
+    if(leaf->k > 0.0 && -leaf->b / leaf->k > origin){
+        origin = -leaf->b / leaf->k;
+        if(origin > right) origin = right;
+    }
+    f->origin = (int)floor(origin);
+    double c = leaf->k * f->origin + leaf->b; // 直线在origin处的取值
+    // 在mult < 2^30且|c| < 2^62的前提下取尽可能大的移位数,
+    // 使(key - origin) * mult + c不会溢出int64
+    int shift = FIXED_MAX_SHIFT;
+    while(shift > 0 && (ldexp(leaf->k, shift) >= ldexp(1.0, 30) ||
+                        ldexp(fabs(c), shift) >= ldexp(1.0, 62))){
+        shift--;
+    }
+    f->shift = shift;
+    f->mult = llround(ldexp(leaf->k, shift));
+    f->c = llround(ldexp(c, shift));
+}
+
+void lr_tree_set_fixed(LR_Tree_Root *root, bool enable){
+    aligned_free(root->fixed);
+    root->fixed = NULL;
+    if(!enable) return;
+    root->fixed = (LR_Tree_Fixed *)aligned_malloc(root->leaf_num *
+                                                  sizeof(LR_Tree_Fixed));
+    for(int i = 0; i < root->leaf_num; i ++){
+        lr_tree_fixed_fit(&root->fixed[i], &root->leaf[i],
+                          root->right_endpoint[i]);
+    }
+}
+
+// 预测key所在B树在全局B树表中的下标, pos非NULL时写入key在该B树内的相对位置,
+// 即预测值的小数部分, 预测值被截断时取0或1
+static inline int lr_tree_predict(const LR_Tree_Root *root, int key,
+                                  double *pos){
+    // 找到第一个存储大于等于key值的right_endpoint数组值的索引, 即对应的叶子节点分支
+    int i = lr_route_find(&root->route, key);
+    if(root->fixed && root->fixed[i].shift >= 0){
+        const LR_Tree_Fixed* f = &root->fixed[i];
+        // 算术右移即向下取整, 负数结果随后被截断为0, 与double版本一致
+        int64_t v = ((int64_t)key - f->origin) * f->mult + f->c;
+        int64_t b_tree_index = v >> f->shift;
+        if(b_tree_index >= f->b_tree_num){
+            b_tree_index = f->b_tree_num - 1;
+            if(pos) *pos = 1.0;
+        }else if(b_tree_index < 0){
+            b_tree_index = 0;
+            if(pos) *pos = 0.0;
+        }else if(pos){
+            *pos = ldexp((double)(v - (b_tree_index << f->shift)), -f->shift);
         }
-        leaf->b_tree_num = 0;
-        free(leaf->b_tree_node);
-        leaf->b_tree_node = NULL;
+        return f->base + (int)b_tree_index;
     }
+    const LR_Tree_Leaf* leaf = &root->leaf[i];
+    // 根据叶子的模型标记, 以拟合直线或样条插值计算出是哪一个B树
+    double y;
+    if(leaf->knot >= 0)
+        y = lr_tree_spline_eval(root->knot + leaf->knot, key);
+    else
+        y = leaf->k * key + leaf->b;
+    int b_tree_index = (int)y;
+    if(b_tree_index >= leaf->b_tree_num){
+        b_tree_index = leaf->b_tree_num - 1;
+        if(pos) *pos = 1.0;
+    }else if(b_tree_index < 0 || y < 0.0){
+        b_tree_index = 0;
+        if(pos) *pos = 0.0;
+    }else if(pos){
+        *pos = y - b_tree_index;
+    }
+    return leaf->base + b_tree_index;
+}
+
+int lr_tree_find_partition(const LR_Tree_Root *root, int key){
+    return lr_tree_predict(root, key, NULL);
+}
+
+void lr_tree_tune_fanout(LR_Tree_Root *root, const int *sorted, int n){
+    int *expected = (int *)calloc(root->b_tree_total, sizeof(int));
+    for(int i = 0; i < n; i++)
+        expected[lr_tree_find_partition(root, sorted[i])]++;
+    for(int p = 0; p < root->b_tree_total; p++)
+        b_forest_set_max_items(root->forest, p,
+                               b_tree_fit_max_items(expected[p],
+                                                    root->forest->elsize));
+    free(expected);
+}
+
+int lr_tree_locate(const LR_Tree_Root *root, int key, double *pos){
+    return lr_tree_predict(root, key, pos);
+}
+
+void lr_tree_set_hint(LR_Tree_Root *root, bool enable){
+    root->hint = enable;
+}
+
+bool lr_tree_set_payload(LR_Tree_Root *root, size_t payload_size){
+    return b_forest_set_payload(root->forest, payload_size);
+}
+
+void lr_tree_set_ranked(LR_Tree_Root *root, bool enable){
+    b_forest_set_ranked(root->forest, enable);
+}
+
+void lr_tree_free(LR_Tree_Root *root){
+    b_forest_free(root->forest); // 释放所有B树内存
     root->leaf_num = 0;
-    free(root->right_endpoint);
-    free(root->leaf_node);
+    root->b_tree_total = 0;
+    lr_route_free(&root->route);
+    lr_tree_set_fixed(root, false);
+    aligned_free(root->right_endpoint);
+    aligned_free(root->leaf);
+    aligned_free(root->knot);
     root->right_endpoint = NULL;
-    root->leaf_node = NULL;
+    root->leaf = NULL;
+    root->knot = NULL;
+    root->forest = NULL;
     free(root);
     root = NULL;
 }
 
+// 返回key所在的B树在森林中的下标, 并以叶子模型预测的相对位置作为hint, 引导该B树内的查找, hint为0时不使用
+// 只用于查询: 按key顺序插入或删除时B树中的现有元素只是最终分布的一部分, 预测位置反而偏离
+static inline int lr_tree_hint_partition(const LR_Tree_Root *lr_tree, int key,
+                                         uint64_t *hint){
+    *hint = 0;
+    if(!lr_tree->hint)
+        return lr_tree_find_partition(lr_tree, key);
+    double pos;
+    int partition = lr_tree_predict(lr_tree, key, &pos);
+    // B树不记录子树大小, 相对位置只在单个节点内能准确换算为下标;
+    // 多层B树的各孩子大小不一, 逐层换算的误差会使查找比直接二分更慢,
+    // 元素很少时二分本身只需几次比较, 这两种情况都不使用hint(置为0)
+    if(b_forest_count(lr_tree->forest, partition) >= HINT_MIN_ITEMS &&
+       b_forest_height(lr_tree->forest, partition) <= 1)
+        *hint = B_Tree_pos_hint(pos);
+    return partition;
+}
+
 bool lr_tree_exist(const LR_Tree_Root *lr_tree, int key){
-    return b_tree_exist(find_b_tree(lr_tree, key), key);
+    return lr_tree_query(lr_tree, key) != NULL;
 }
 
 void lr_tree_erase(const LR_Tree_Root *lr_tree, int key){
-    b_tree_erase(find_b_tree(lr_tree, key), key);
+    b_forest_erase(lr_tree->forest, lr_tree_find_partition(lr_tree, key), key);
 }
 
 void lr_tree_insert(const LR_Tree_Root *lr_tree, int key, const char *s){
-    b_tree_insert(find_b_tree(lr_tree, key), key, s);
+    b_forest_insert(lr_tree->forest, lr_tree_find_partition(lr_tree, key), key,
+                    s);
+}
+
+const char *lr_tree_upsert(const LR_Tree_Root *lr_tree, int key, const char *s,
+                           bool *ok){
+    return b_forest_upsert(lr_tree->forest, lr_tree_find_partition(lr_tree, key),
+                           key, s, ok);
+}
+
+KV_Node *lr_tree_get_or_insert(const LR_Tree_Root *lr_tree, int key,
+                               const char *s, bool *inserted){
+    return b_forest_get_or_insert(lr_tree->forest,
+                                  lr_tree_find_partition(lr_tree, key), key, s,
+                                  inserted);
+}
+
+bool lr_tree_update(const LR_Tree_Root *lr_tree, int key, KV_Update fn,
+                    void *udata){
+    return b_forest_update(lr_tree->forest,
+                           lr_tree_find_partition(lr_tree, key), key, fn,
+                           udata);
+}
+
+bool lr_tree_merge(const LR_Tree_Root *lr_tree, const int *keys,
+                   const char **vals, int n){
+    Value_Log *log = lr_tree->forest->vlog;
+    if(!log) // 定长值模式下没有值日志, 只能逐个lr_tree_insert_pod
+        return false;
+    KV_Node *run = NULL;
+    int run_num = 0, run_cap = 0, run_partition = -1;
+    bool ok = true;
+    for(int i = 0; i < n; i++){
+        int partition = lr_tree_find_partition(lr_tree, keys[i]);
+        bool dup = run_num > 0 && partition == run_partition &&
+            keys[i] == run[run_num - 1].key;
+        // 分区改变或key不再递增时, 先把攒下的一段并入其B树; 须在追加本元素的值之前进行,
+        // 因为并入后可能整理值日志, 而尚未进入B树的句柄不会被搬走, 会随旧段一起归还
+        if(!dup && run_num > 0 && (partition != run_partition ||
+                                   keys[i] < run[run_num - 1].key)){
+            ok = b_forest_merge(lr_tree->forest, run_partition, run,
+                                run_num);
+            run_num = 0;
+            if(!ok)
+                break;
+        }
+        if(run_num == run_cap){
+            int cap = run_cap ? run_cap * 2 : 1024;
+            KV_Node *grown = (KV_Node *)realloc(run, cap * sizeof(KV_Node));
+            if(!grown){
+                ok = false;
+                break;
+            }
+            run = grown;
+            run_cap = cap;
+        }
+        uint32_t val = value_log_append(log, vals ? vals[i] : "");
+        if(val == VALUE_LOG_NULL){
+            ok = false;
+            break;
+        }
+        if(dup){
+            // 重复的key与lr_tree_insert一样以后者为准
+            value_log_release(log, run[run_num - 1].val);
+            run[run_num - 1].val = val;
+            continue;
+        }
+        run[run_num].key = keys[i];
+        run[run_num].val = val;
+        run_num++;
+        run_partition = partition;
+    }
+    if(ok && run_num > 0)
+        ok = b_forest_merge(lr_tree->forest, run_partition, run, run_num);
+    else
+        for(int i = 0; i < run_num; i++) // 未并入的值随之失效
+            value_log_release(log, run[i].val);
+    free(run);
+    return ok;
+}
+
+bool lr_tree_bulk_load(const LR_Tree_Root *lr_tree, const int *keys,
+                       const char **vals, int n){
+    return lr_tree_merge(lr_tree, keys, vals, n);
+}
+
+bool lr_tree_range(const LR_Tree_Root *lr_tree, int lo, int hi, KV_Visit fn,
+                   void *udata){
+    if(lo > hi)
+        return true;
+    // 各叶子的模型均单调不减, 叶子又按key值段排列, 因此B树在全局B树表中按key有序,
+    // [lo, hi]内的元素只可能位于lo与hi所在的B树及其之间的B树中
+    return b_forest_range(lr_tree->forest, lr_tree_find_partition(lr_tree, lo),
+                          lr_tree_find_partition(lr_tree, hi), lo, hi, fn,
+                          udata);
+}
+
+double lr_tree_estimate_count(const LR_Tree_Root *lr_tree, int lo, int hi,
+                              double *error){
+    if(lo > hi){
+        if(error) *error = 0.0;
+        return 0.0;
+    }
+    // 同lr_tree_range, first与last之间的B树中的元素都落在(lo, hi)内, 而两端B树中落在区间内的
+    // 元素数在0与整棵树的元素数之间, 由此得到真实个数的上下界
+    double pos_lo, pos_hi;
+    int first = lr_tree_locate(lr_tree, lo, &pos_lo);
+    int last = lr_tree_locate(lr_tree, hi, &pos_hi);
+    const B_Forest *forest = lr_tree->forest;
+    double n_first = (double)b_forest_count(forest, first);
+    double low, high, estimate;
+    if(first == last){
+        low = 0.0;
+        high = n_first;
+        estimate = pos_hi > pos_lo ? n_first * (pos_hi - pos_lo) : 0.0;
+    }else{
+        double n_last = (double)b_forest_count(forest, last);
+        low = (double)b_forest_count_range(forest, first + 1, last - 1);
+        high = low + n_first + n_last;
+        estimate = low + n_first * (1.0 - pos_lo) + n_last * pos_hi;
+    }
+    if(error) *error = fmax(estimate - low, high - estimate);
+    return estimate;
+}
+
+B_Forest_Cursor *lr_tree_cursor_new(const LR_Tree_Root *lr_tree){
+    return b_forest_cursor_new(lr_tree->forest);
+}
+
+bool lr_tree_cursor_seek(const LR_Tree_Root *lr_tree, B_Forest_Cursor *cursor,
+                         int key){
+    return b_forest_cursor_seek(cursor, lr_tree_find_partition(lr_tree, key),
+                                key);
+}
+
+KV_Node *lr_tree_lower_bound(const LR_Tree_Root *lr_tree, int key){
+    return b_forest_ceiling(lr_tree->forest,
+                            lr_tree_find_partition(lr_tree, key), key);
+}
+
+KV_Node *lr_tree_ceiling(const LR_Tree_Root *lr_tree, int key){
+    return lr_tree_lower_bound(lr_tree, key);
+}
+
+KV_Node *lr_tree_floor(const LR_Tree_Root *lr_tree, int key){
+    return b_forest_floor(lr_tree->forest, lr_tree_find_partition(lr_tree, key),
+                          key);
+}
+
+KV_Node *lr_tree_min(const LR_Tree_Root *lr_tree){
+    return b_forest_min(lr_tree->forest);
+}
+
+KV_Node *lr_tree_max(const LR_Tree_Root *lr_tree){
+    return b_forest_max(lr_tree->forest);
+}
+
+size_t lr_tree_rank(const LR_Tree_Root *lr_tree, int key){
+    return b_forest_rank(lr_tree->forest, lr_tree_find_partition(lr_tree, key),
+                         key);
+}
+
+KV_Node *lr_tree_select(const LR_Tree_Root *lr_tree, size_t index){
+    return b_forest_select(lr_tree->forest, index);
 }
 
 KV_Node *lr_tree_query(const LR_Tree_Root *lr_tree, int key){
-    return b_tree_query(find_b_tree(lr_tree, key), key);
+    uint64_t hint;
+    int partition = lr_tree_hint_partition(lr_tree, key, &hint);
+    if(hint)
+        return b_forest_query_hint(lr_tree->forest, partition, key, &hint);
+    return b_forest_query(lr_tree->forest, partition, key);
+}
+
+const char *lr_tree_value(const LR_Tree_Root *lr_tree, const KV_Node *node){
+    return b_forest_value(lr_tree->forest, node);
+}
+
+void lr_tree_insert_pod(const LR_Tree_Root *lr_tree, int key, const void *val){
+    b_forest_insert_pod(lr_tree->forest, lr_tree_find_partition(lr_tree, key),
+                        key, val);
+}
+
+bool lr_tree_query_pod(const LR_Tree_Root *lr_tree, int key, void *val){
+    return b_forest_payload(lr_tree->forest, lr_tree_query(lr_tree, key), val);
 }
 
 void print_lr_tree_root(const LR_Tree_Root *lr_tree, int key){
-    print_kv_node(lr_tree_query(lr_tree, key));
-}
\ No newline at end of file
+    KV_Node *node = lr_tree_query(lr_tree, key);
+    print_kv_node(node, lr_tree_value(lr_tree, node));
+}
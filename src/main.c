@@ -1,12 +1,893 @@
 #include "b_tree.c"
+#include "distribution.c"
 #include "fool_tree.c"
 #include "hash_tree.c"
+#include "lr_route.c"
 #include "lr_tree.c"
+#include "slab.c"
 #include "utility.c"
+#include "value_log.c"
+
+// 根节点路由方式的微基准: 叶子数量从10到1e6, 统计每次路由的平均耗时
+static void bench_route(void) {
+    const char *name[] = {"二分", "RMI", "Eytzinger", "SIMD"};
+    LR_Route_Mode mode[] = {LR_ROUTE_BISECT, LR_ROUTE_RMI, LR_ROUTE_EYTZINGER,
+                            LR_ROUTE_SIMD};
+    int n_query = 1e7; // 每种方式的路由次数
+    int *query = (int *)malloc(n_query * sizeof(int));
+    for (int i = 0; i < n_query; i++) {
+        query[i] = gauss_rand_integer();
+    }
+    for (int leaf_num = 10; leaf_num <= 1000000; leaf_num *= 10) {
+        // 以服从正态分布的有序key作为right_endpoint, 最后一段兜底
+        int *endpoint = generate_sorted_arr(leaf_num);
+        endpoint[leaf_num - 1] = INT_MAX - 1;
+        for (int m = 0; m < 4; m++) {
+            LR_Route route;
+            lr_route_init(&route, endpoint, leaf_num);
+            lr_route_build(&route, mode[m]);
+            long long checksum = 0; // 防止路由结果被编译器优化掉
+            clock_t start = clock();
+            for (int i = 0; i < n_query; i++) {
+                checksum += lr_route_find(&route, query[i]);
+            }
+            clock_t end = clock();
+            printf("叶子数量 %d, %s路由单次时间: %lf (纳秒) [%lld]\n", leaf_num,
+                   name[m],
+                   ((double)(end - start)) / CLOCKS_PER_SEC * 1e9 / n_query,
+                   checksum);
+            lr_route_free(&route);
+        }
+        free(endpoint);
+    }
+    free(query);
+}
+
+// 叶子模型的double与定点整数两种形式的路由耗时对比, 并统计两者选出不同B树的次数
+static void bench_model(int leaf_num, int b_tree_num) {
+    int n = 1e6;       // 训练样本数量
+    int n_query = 1e7; // 路由次数
+    int *arr = generate_sorted_arr(n);
+    double mean, sigma;
+    statistic_feature(arr, n, &mean, &sigma);
+    int *query = (int *)malloc(n_query * sizeof(int));
+    for (int i = 0; i < n_query; i++) {
+        query[i] = gauss_rand_integer();
+    }
+    LR_Tree_Root *lr_tree[2];
+    lr_tree[0] = lr_tree_create(mean, sigma, leaf_num, b_tree_num, INT_MIN + 1,
+                                INT_MAX - 1, LR_ROUTE_EYTZINGER, n);
+    lr_tree[1] = lr_tree_create_from_keys(arr, n, leaf_num, b_tree_num,
+                                          INT_MIN + 1, INT_MAX - 1,
+                                          LR_ROUTE_EYTZINGER);
+    const char *tree_name[] = {"正态分布拟合", "样本拟合"};
+    int *partition = (int *)malloc(n_query * sizeof(int));
+    for (int t = 0; t < 2; t++) {
+        for (int fixed = 0; fixed <= 1; fixed++) {
+            lr_tree_set_fixed(lr_tree[t], fixed);
+            int diff = 0; // 与double版本选出的B树不同的次数
+            clock_t start = clock();
+            for (int i = 0; i < n_query; i++) {
+                int p = lr_tree_find_partition(lr_tree[t], query[i]);
+                if (fixed)
+                    diff += (p != partition[i]);
+                else
+                    partition[i] = p;
+            }
+            clock_t end = clock();
+            printf("%s, %s模型路由单次时间: %lf (纳秒), 不一致次数: %d\n",
+                   tree_name[t], fixed ? "定点整数" : "double",
+                   ((double)(end - start)) / CLOCKS_PER_SEC * 1e9 / n_query,
+                   diff);
+        }
+        lr_tree_free(lr_tree[t]);
+    }
+    free(partition);
+    free(query);
+    free(arr);
+}
+
+// 打印线性回归树中各B树所存储元素数量的最大值、最小值和标准差, 以及使用样条模型的叶子数
+static void print_occupancy(const char *name, const LR_Tree_Root *lr_tree) {
+    size_t max_cnt = 0, min_cnt = (size_t)-1;
+    double sum = 0.0, square_sum = 0.0;
+    for (int i = 0; i < lr_tree->b_tree_total; i++) {
+        size_t cnt = b_forest_count(lr_tree->forest, i);
+        max_cnt = cnt > max_cnt ? cnt : max_cnt;
+        min_cnt = cnt < min_cnt ? cnt : min_cnt;
+        sum += cnt;
+        square_sum += (double)cnt * cnt;
+    }
+    int m = lr_tree->b_tree_total;
+    printf("%s: B树元素数量 最大 %zu, 最小 %zu, 标准差 %lf, 样条叶子 %d/%d\n",
+           name, max_cnt, min_cnt, sqrt(square_sum / m - (sum / m) * (sum / m)),
+           lr_tree->knot_num / SPLINE_KNOT, lr_tree->leaf_num);
+}
+
+// 对不同分布族产生的key值进行分布拟合, 并对比拟合分布与正态假设下的划分均衡程度
+static void bench_dist(int leaf_num, int b_tree_num) {
+    int n = 1e6;
+    double weight[] = {0.7, 0.3}, mean[] = {-2e7, 3e7}, sd[] = {4e6, 1e7};
+    Distribution truth[] = {
+        dist_gaussian(RAND_MEAN, RAND_SIGMA),
+        dist_uniform(-1e9, 1e9),
+        dist_lognormal(-1e6, 14.0, 1.5),
+        dist_exponential(0.0, 1e-7),
+        dist_zipf(0.0, 2e9, 0.8),
+        dist_mixture(2, weight, mean, sd),
+    };
+    for (int t = 0; t < DIST_TYPE_NUM; t++) {
+        int *arr = dist_generate_sorted_arr(&truth[t], n);
+        double ks, avg, sigma;
+        Distribution fit = dist_fit(arr, n, &ks);
+        printf("真实分布 %s, 拟合结果 %s, KS统计量 %lf\n", dist_name(&truth[t]),
+               dist_name(&fit), ks);
+        statistic_feature(arr, n, &avg, &sigma);
+        LR_Tree_Root *lr_tree[2];
+        lr_tree[0] = lr_tree_create(avg, sigma, leaf_num, b_tree_num,
+                                    INT_MIN + 1, INT_MAX - 1, LR_ROUTE_BISECT,
+                                    n);
+        lr_tree[1] = lr_tree_create_dist(&fit, leaf_num, b_tree_num,
+                                         INT_MIN + 1, INT_MAX - 1,
+                                         LR_ROUTE_BISECT, n);
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < n; j++) {
+                lr_tree_insert(lr_tree[i], arr[j], "");
+            }
+            print_occupancy(i ? "  拟合分布" : "  正态假设", lr_tree[i]);
+            lr_tree_free(lr_tree[i]);
+        }
+        free(arr);
+    }
+}
+
+// 测试按分布构建线性回归树的墙上耗时
+static void bench_build(int leaf_num, int b_tree_num) {
+    Distribution dist = dist_gaussian(RAND_MEAN, RAND_SIGMA);
+    double start = wall_time_ms();
+    LR_Tree_Root *lr_tree =
+        lr_tree_create_dist(&dist, leaf_num, b_tree_num, INT_MIN + 1,
+                            INT_MAX - 1, LR_ROUTE_BISECT, 0);
+    double end = wall_time_ms();
+    printf("叶子 %d, B树 %d, 线程 %d: 构建耗时 %.1lf ms, 样条叶子 %d\n", leaf_num,
+           lr_tree->b_tree_total, cpu_count(), end - start,
+           lr_tree->knot_num / SPLINE_KNOT);
+    lr_tree_free(lr_tree);
+}
+
+// 返回[0, 1)之间的均匀随机数, 以两次rand拼接避免RAND_MAX过小时精度不足
+static double rand_unit(void) {
+    return (rand() * (RAND_MAX + 1.0) + rand()) /
+           ((RAND_MAX + 1.0) * (RAND_MAX + 1.0));
+}
+
+// 产生m个查询key: 90%落在3个各占1%数据量的热点区间内, 其余在全部数据上均匀分布
+static int *generate_hot_trace(const int *arr, int n, int m) {
+    const double hot[] = {0.2, 0.5, 0.7}; // 热点区间起始位置的分位
+    int *trace = (int *)malloc(m * sizeof(int));
+    for (int i = 0; i < m; i++) {
+        int rank;
+        if (rand_unit() < 0.9)
+            rank = (int)((hot[rand() % 3] + 0.01 * rand_unit()) * n);
+        else
+            rank = (int)(rand_unit() * n);
+        trace[i] = arr[rank];
+    }
+    return trace;
+}
+
+// 对比按key数量均分与按访问负载均分的线性回归树在热点查询下的代价
+// 以一条查询轨迹训练, 另一条独立产生的查询轨迹评估
+static void bench_workload(int leaf_num, int b_tree_num) {
+    int n = 1e6, m = 1e6, bucket_num = 1000;
+    int *arr = generate_sorted_arr(n);
+    int *train = generate_hot_trace(arr, n, m);
+    int *test = generate_hot_trace(arr, n, m);
+    // 以等数据量的桶统计训练轨迹的访问频率直方图
+    int *bucket_right = (int *)malloc(bucket_num * sizeof(int));
+    double *freq = (double *)calloc(bucket_num, sizeof(double));
+    for (int t = 0; t < bucket_num; t++)
+        bucket_right[t] = arr[(long long)n * (t + 1) / bucket_num - 1];
+    for (int i = 0; i < m; i++) {
+        int lo = 0, hi = bucket_num - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (bucket_right[mid] >= train[i])
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        freq[lo] += 1.0;
+    }
+    const char *name[] = {"按key数量", "轨迹 alpha=0.5", "直方图 alpha=0.5",
+                          "轨迹 alpha=0.9"};
+    LR_Tree_Root *lr_tree[4];
+    lr_tree[0] = lr_tree_create_from_keys(arr, n, leaf_num, b_tree_num,
+                                          INT_MIN + 1, INT_MAX - 1,
+                                          LR_ROUTE_BISECT);
+    lr_tree[1] = lr_tree_create_workload(arr, n, train, m, 0.5, leaf_num,
+                                         b_tree_num, INT_MIN + 1, INT_MAX - 1,
+                                         LR_ROUTE_BISECT);
+    lr_tree[2] = lr_tree_create_histogram(
+        arr, n, bucket_right, freq, bucket_num, 0.5, leaf_num, b_tree_num,
+        INT_MIN + 1, INT_MAX - 1, LR_ROUTE_BISECT);
+    lr_tree[3] = lr_tree_create_workload(arr, n, train, m, 0.9, leaf_num,
+                                         b_tree_num, INT_MIN + 1, INT_MAX - 1,
+                                         LR_ROUTE_BISECT);
+    for (int t = 0; t < 4; t++) {
+        for (int i = 0; i < n; i++)
+            lr_tree_insert(lr_tree[t], arr[i], "");
+        int total = lr_tree[t]->b_tree_total;
+        int *hit = (int *)calloc(total, sizeof(int));
+        clock_t start = clock();
+        for (int i = 0; i < m; i++)
+            lr_tree_query(lr_tree[t], test[i]);
+        clock_t end = clock();
+        for (int i = 0; i < m; i++)
+            hit[lr_tree_find_partition(lr_tree[t], test[i])]++;
+        // 期望代价: 每次查询在所落B树上的比较次数约为log2(元素数 + 1)
+        double cost = 0.0;
+        int max_hit = 0;
+        size_t max_cnt = 0;
+        for (int p = 0; p < total; p++) {
+            size_t cnt = b_forest_count(lr_tree[t]->forest, p);
+            cost += hit[p] * log2((double)cnt + 1.0);
+            max_hit = hit[p] > max_hit ? hit[p] : max_hit;
+            max_cnt = cnt > max_cnt ? cnt : max_cnt;
+        }
+        printf("%-18s: 平均比较次数 %.2lf, 最热B树访问占比 %.4lf, "
+               "最大B树元素数 %zu, 查询耗时 %.0lf ms\n",
+               name[t], cost / m, (double)max_hit / m, max_cnt,
+               (double)(end - start) * 1000 / CLOCKS_PER_SEC);
+        free(hit);
+        lr_tree_free(lr_tree[t]);
+    }
+    free(bucket_right);
+    free(freq);
+    free(train);
+    free(test);
+    free(arr);
+}
+
+// 对比开启与关闭模型引导的B树内查找时, 随机查询的耗时
+static void bench_hint(int leaf_num, int b_tree_num) {
+    int n = 1e6;
+    int *arr = generate_sorted_arr(n);
+    int *query = (int *)malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++)
+        query[i] = arr[(int)(rand_unit() * n)];
+    LR_Tree_Root *lr_tree = lr_tree_create_from_keys(
+        arr, n, leaf_num, b_tree_num, INT_MIN + 1, INT_MAX - 1,
+        LR_ROUTE_BISECT);
+    lr_tree_bulk_load(lr_tree, arr, NULL, n);
+    for (int i = 0; i < n; i++) // 预热, 避免第一轮查询计入冷缓存的开销
+        lr_tree_query(lr_tree, query[i]);
+    for (int t = 0; t < 2; t++) {
+        lr_tree_set_hint(lr_tree, t == 1);
+        int miss = 0;
+        double start = wall_time_ms();
+        for (int i = 0; i < n; i++)
+            miss += lr_tree_query(lr_tree, query[i]) == NULL;
+        double end = wall_time_ms();
+        printf("%s: 查询耗时 %.0lf ms, 未找到 %d\n", t ? "模型引导" : "直接二分",
+               end - start, miss);
+    }
+    lr_tree_free(lr_tree);
+    free(query);
+    free(arr);
+}
+
+// 对比逐个插入与批量装入n个有序key的耗时, 并检查批量装入后所有key都能查到
+static void bench_bulk(int n, int leaf_num, int b_tree_num) {
+    int *arr = generate_sorted_arr(n);
+    const char *name[] = {"逐个插入", "批量装入"};
+    for (int t = 0; t < 2; t++) {
+        LR_Tree_Root *lr_tree = lr_tree_create_from_keys(
+            arr, n, leaf_num, b_tree_num, INT_MIN + 1, INT_MAX - 1,
+            LR_ROUTE_BISECT);
+        double start = wall_time_ms();
+        if (t == 0) {
+            for (int i = 0; i < n; i++)
+                lr_tree_insert(lr_tree, arr[i], "");
+        } else {
+            lr_tree_bulk_load(lr_tree, arr, NULL, n);
+        }
+        double end = wall_time_ms();
+        int miss = 0;
+        for (int i = 0; i < n; i++)
+            miss += lr_tree_query(lr_tree, arr[i]) == NULL;
+        printf("%s: 装入 %d 个key耗时 %.0lf ms, 未找到 %d\n", name[t], n,
+               end - start, miss);
+        lr_tree_free(lr_tree);
+    }
+    free(arr);
+}
+
+// 向已有base个元素的线性回归树并入10^3到10^7个有序key, 对比逐个插入与批量并入的吞吐量
+static void bench_merge(int leaf_num, int b_tree_num) {
+    int base = 1e6;
+    int *arr = generate_sorted_arr(base);
+    for (int batch = 1000; batch <= 10000000; batch *= 10) {
+        int *run = generate_sorted_arr(batch);
+        double rate[2];
+        size_t count[2];
+        for (int t = 0; t < 2; t++) {
+            LR_Tree_Root *lr_tree = lr_tree_create_from_keys(
+                arr, base, leaf_num, b_tree_num, INT_MIN + 1, INT_MAX - 1,
+                LR_ROUTE_BISECT);
+            lr_tree_bulk_load(lr_tree, arr, NULL, base);
+            double start = wall_time_ms();
+            if (t == 0) {
+                for (int i = 0; i < batch; i++)
+                    lr_tree_insert(lr_tree, run[i], "");
+            } else {
+                lr_tree_merge(lr_tree, run, NULL, batch);
+            }
+            double end = wall_time_ms();
+            rate[t] = batch / (end - start) / 1000.0;
+            count[t] = 0;
+            for (int p = 0; p < lr_tree->b_tree_total; p++)
+                count[t] += b_forest_count(lr_tree->forest, p);
+            lr_tree_free(lr_tree);
+        }
+        printf("并入 %8d 个key: 逐个插入 %.2lf M/s, 批量并入 %.2lf M/s, "
+               "元素数 %s\n", batch, rate[0], rate[1],
+               count[0] == count[1] ? "一致" : "不一致");
+        free(run);
+    }
+    free(arr);
+}
+
+// 对比默认节点容量、按模型预期元素数选择节点容量以及按实际key覆盖时, 随机顺序插入后的内存占用和随机查询耗时
+static void bench_fanout(int leaf_num, int b_tree_num) {
+    int n = 1e6;
+    int *arr = generate_sorted_arr(n);
+    int *order = (int *)malloc(n * sizeof(int));
+    int *query = (int *)malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++)
+        order[i] = arr[i];
+    for (int i = n - 1; i > 0; i--) { // 打乱为随机插入顺序
+        int j = (int)(rand_unit() * (i + 1));
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (int i = 0; i < n; i++)
+        query[i] = arr[(int)(rand_unit() * n)];
+    double mean, sigma;
+    statistic_feature(arr, n, &mean, &sigma);
+    // 依次为: 不给出预期元素数, 按模型的概率质量选择, 再以实际key覆盖
+    const char *name[] = {"默认节点容量", "按模型预期元素数", "按样本计数覆盖"};
+    for (int t = 0; t < 3; t++) {
+        LR_Tree_Root *lr_tree =
+            lr_tree_create(mean, sigma, leaf_num, b_tree_num, INT_MIN + 1,
+                           INT_MAX - 1, LR_ROUTE_BISECT, t ? n : 0);
+        if (t == 2)
+            lr_tree_tune_fanout(lr_tree, arr, n);
+        for (int i = 0; i < n; i++)
+            lr_tree_insert(lr_tree, order[i], "");
+        for (int i = 0; i < n; i++) // 预热
+            lr_tree_query(lr_tree, query[i]);
+        double start = wall_time_ms();
+        for (int i = 0; i < n; i++)
+            lr_tree_query(lr_tree, query[i]);
+        double end = wall_time_ms();
+        double height = 0.0;
+        for (int p = 0; p < lr_tree->b_tree_total; p++)
+            height += b_forest_height(lr_tree->forest, p);
+        printf("%s: 节点内存 %.1lf MB, 平均B树高度 %.2lf, 单次查询 %.1lf ns\n",
+               name[t], b_forest_memory(lr_tree->forest) / 1048576.0,
+               height / lr_tree->b_tree_total, (end - start) * 1e6 / n);
+        lr_tree_free(lr_tree);
+    }
+    free(query);
+    free(order);
+    free(arr);
+}
+
+// 更新密集负载: 插入n个key后按随机顺序整体更新rounds轮, 统计每次写入的耗时和森林的内存占用
+static void bench_update(int n, int rounds) {
+    int *arr = generate_sorted_arr(n);
+    int *order = (int *)malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++)
+        order[i] = arr[i];
+    for (int i = n - 1; i > 0; i--) { // 打乱为随机更新顺序
+        int j = (int)(rand_unit() * (i + 1));
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    char **str = generate_str(n, arr);
+    char **changed = generate_str(n, order);
+    LR_Tree_Root *lr_tree = lr_tree_create_from_keys(
+        arr, n, 100, 100, INT_MIN + 1, INT_MAX - 1, LR_ROUTE_BISECT);
+    double start = wall_time_ms();
+    for (int i = 0; i < n; i++)
+        lr_tree_insert(lr_tree, arr[i], str[i]);
+    printf("插入: 单次 %.1lf ns, 内存 %.1lf MB\n",
+           (wall_time_ms() - start) * 1e6 / n,
+           b_forest_memory(lr_tree->forest) / 1048576.0);
+    for (int r = 1; r <= rounds; r++) {
+        start = wall_time_ms();
+        for (int i = 0; i < n; i++)
+            lr_tree_insert(lr_tree, order[i], r & 1 ? changed[i] : str[i]);
+        printf("第%d轮更新: 单次 %.1lf ns, 内存 %.1lf MB\n", r,
+               (wall_time_ms() - start) * 1e6 / n,
+               b_forest_memory(lr_tree->forest) / 1048576.0);
+    }
+    lr_tree_free(lr_tree);
+    for (int i = 0; i < n; i++)
+        free(changed[i]);
+    free(changed);
+    free(order);
+    data_free(n, arr, str);
+}
+
+// 对比按int key特化的B树与通用B树在同一组随机操作下的耗时
+static void bench_b_tree(int n) {
+    int *arr = generate_sorted_arr(n);
+    int *key = (int *)malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++)
+        key[i] = arr[i];
+    for (int i = n - 1; i > 0; i--) { // 打乱为随机顺序
+        int j = (int)(rand_unit() * (i + 1));
+        int t = key[i];
+        key[i] = key[j];
+        key[j] = t;
+    }
+    const char *name[] = {"通用B树", "特化B树"};
+    for (int t = 0; t < 2; t++) {
+        struct B_Tree *b_tree = t ? b_tree_create() : b_tree_create_generic();
+        double time[3];
+        int miss = 0;
+        time[0] = wall_time_ms();
+        for (int i = 0; i < n; i++)
+            b_tree_insert(b_tree, key[i], "");
+        time[1] = wall_time_ms();
+        for (int i = 0; i < n; i++)
+            miss += b_tree_query(b_tree, key[n - 1 - i]) == NULL;
+        time[2] = wall_time_ms();
+        for (int i = 0; i < n; i++)
+            b_tree_erase(b_tree, key[i]);
+        printf("%s: 插入 %.0lf ms, 查询 %.0lf ms, 删除 %.0lf ms, 未找到 %d\n",
+               name[t], time[1] - time[0], time[2] - time[1],
+               wall_time_ms() - time[2], miss);
+        b_tree_free(b_tree);
+    }
+    free(key);
+    free(arr);
+}
+
+// 对比字符串值与payload字节的定长值: 同一组随机key的插入、查询耗时与森林内存, 定长值逐字节校验
+static void bench_pod(int n, int payload) {
+    if (payload < 0 || payload % sizeof(int) != 0 ||
+        payload > B_TREE_PAYLOAD_MAX) {
+        printf("值的字节数须为 %zu 的倍数且不超过 %d\n", sizeof(int),
+               B_TREE_PAYLOAD_MAX);
+        return;
+    }
+    int *arr = generate_sorted_arr(n);
+    int *key = (int *)malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++)
+        key[i] = arr[i];
+    for (int i = n - 1; i > 0; i--) { // 打乱为随机顺序
+        int j = (int)(rand_unit() * (i + 1));
+        int t = key[i];
+        key[i] = key[j];
+        key[j] = t;
+    }
+    char **str = generate_str(n, key);
+    const char *name[] = {"字符串值", "定长值"};
+    for (int t = 0; t < 2; t++) {
+        LR_Tree_Root *lr_tree = lr_tree_create_from_keys(
+            arr, n, 100, 100, INT_MIN + 1, INT_MAX - 1, LR_ROUTE_BISECT);
+        if (t)
+            lr_tree_set_payload(lr_tree, payload);
+        int val[B_TREE_PAYLOAD_MAX / sizeof(int)] = {0};
+        int got[B_TREE_PAYLOAD_MAX / sizeof(int)];
+        double time[3];
+        int miss = 0;
+        time[0] = wall_time_ms();
+        for (int i = 0; i < n; i++) {
+            if (t) {
+                val[0] = key[i];
+                lr_tree_insert_pod(lr_tree, key[i], val);
+            } else {
+                lr_tree_insert(lr_tree, key[i], str[i]);
+            }
+        }
+        time[1] = wall_time_ms();
+        for (int i = 0; i < n; i++) {
+            if (t)
+                miss += !lr_tree_query_pod(lr_tree, key[n - 1 - i], got) ||
+                        got[0] != key[n - 1 - i];
+            else
+                miss += lr_tree_value(lr_tree, lr_tree_query(
+                            lr_tree, key[n - 1 - i])) == NULL;
+        }
+        time[2] = wall_time_ms();
+        printf("%s: 插入 %.0lf ms, 查询 %.0lf ms, 内存 %.1lf MB, 未找到 %d\n",
+               name[t], time[1] - time[0], time[2] - time[1],
+               b_forest_memory(lr_tree->forest) / 1048576.0, miss);
+        lr_tree_free(lr_tree);
+    }
+    free(key);
+    data_free(n, arr, str);
+}
+
+// 读-改-写的回调: 值为"n=计数", 计数加一后写回udata指向的缓冲区
+static const char *bump_value(int key, const char *old, void *udata) {
+    (void)key;
+    sprintf((char *)udata, "n=%d", atoi(old + 2) + 1);
+    return (const char *)udata;
+}
+
+// 对比查询后再插入与lr_tree_update完成同样的读-改-写, 以及lr_tree_upsert与lr_tree_insert的耗时
+static void bench_rmw(int n, int rounds) {
+    int *arr = generate_sorted_arr(n);
+    LR_Tree_Root *lr_tree = lr_tree_create_from_keys(
+        arr, n, 100, 100, INT_MIN + 1, INT_MAX - 1, LR_ROUTE_BISECT);
+    for (int i = 0; i < n; i++)
+        lr_tree_get_or_insert(lr_tree, arr[i], "n=0", NULL);
+    char buf[32];
+    double time[4];
+    time[0] = wall_time_ms();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < n; i++) {
+            const char *old = lr_tree_value(lr_tree,
+                                            lr_tree_query(lr_tree, arr[i]));
+            lr_tree_insert(lr_tree, arr[i], bump_value(arr[i], old, buf));
+        }
+    time[1] = wall_time_ms();
+    for (int r = 0; r < rounds; r++)
+        for (int i = 0; i < n; i++)
+            lr_tree_update(lr_tree, arr[i], bump_value, buf);
+    time[2] = wall_time_ms();
+    for (int i = 0; i < n; i++)
+        lr_tree_upsert(lr_tree, arr[i], "n=0", NULL);
+    time[3] = wall_time_ms();
+    int wrong = 0;
+    for (int i = 0; i < n; i++)
+        wrong += strcmp(lr_tree_value(lr_tree, lr_tree_query(lr_tree, arr[i])),
+                        "n=0") != 0;
+    printf("查询+插入: 单次 %.1lf ns, update: 单次 %.1lf ns, upsert: 单次 %.1lf "
+           "ns, 值错误 %d\n",
+           (time[1] - time[0]) * 1e6 / ((double)n * rounds),
+           (time[2] - time[1]) * 1e6 / ((double)n * rounds),
+           (time[3] - time[2]) * 1e6 / n, wrong);
+    lr_tree_free(lr_tree);
+    free(arr);
+}
+
+// lr_tree_range的回调: 统计元素数并检查key递增
+static bool count_range(const KV_Node *node, void *udata) {
+    long long *state = (long long *)udata; // [0]为元素数, [1]为上一个key, [2]为逆序次数
+    state[2] += state[0] > 0 && node->key <= state[1];
+    state[0]++;
+    state[1] = node->key;
+    return true;
+}
+
+// 在n个key上做n_range次随机范围查询, 每次约覆盖width个key, 与有序数组上的二分结果核对元素数
+static void bench_range(int leaf_num, int b_tree_num, int width) {
+    int n = 1e6, n_range = 1e5;
+    int *arr = generate_sorted_arr(n);
+    LR_Tree_Root *lr_tree = lr_tree_create_from_keys(
+        arr, n, leaf_num, b_tree_num, INT_MIN + 1, INT_MAX - 1,
+        LR_ROUTE_BISECT);
+    lr_tree_bulk_load(lr_tree, arr, NULL, n);
+    int *lo = (int *)malloc(n_range * sizeof(int));
+    int *hi = (int *)malloc(n_range * sizeof(int));
+    for (int r = 0; r < n_range; r++) {
+        int i = (int)(rand_unit() * (n - width));
+        lo[r] = arr[i];
+        hi[r] = arr[i + width - 1];
+    }
+    long long total = 0, wrong = 0, disorder = 0;
+    double start = wall_time_ms();
+    for (int r = 0; r < n_range; r++) {
+        long long state[3] = {0, 0, 0};
+        lr_tree_range(lr_tree, lo[r], hi[r], count_range, state);
+        total += state[0];
+        wrong += state[0] != width;
+        disorder += state[2];
+    }
+    double end = wall_time_ms();
+    printf("范围查询 %d 次, 每次 %d 个key: 单次 %.0lf ns, 共 %lld 个元素, "
+           "数量错误 %lld, 逆序 %lld\n",
+           n_range, width, (end - start) * 1e6 / n_range, total, wrong,
+           disorder);
+    free(lo);
+    free(hi);
+    lr_tree_free(lr_tree);
+    free(arr);
+}
+
+// 以游标正序、逆序各遍历一次全部元素, 并按每页page个key分页导出, 与有序key数组逐个核对
+static void bench_cursor(int leaf_num, int b_tree_num, int page) {
+    int n = 1e6;
+    int *arr = generate_sorted_arr(n);
+    LR_Tree_Root *lr_tree = lr_tree_create_from_keys(
+        arr, n, leaf_num, b_tree_num, INT_MIN + 1, INT_MAX - 1,
+        LR_ROUTE_BISECT);
+    lr_tree_bulk_load(lr_tree, arr, NULL, n);
+    B_Forest_Cursor *cursor = lr_tree_cursor_new(lr_tree);
+    int wrong = 0, i = 0;
+    double time[4];
+    time[0] = wall_time_ms();
+    for (bool ok = b_forest_cursor_first(cursor); ok;
+         ok = b_forest_cursor_next(cursor))
+        wrong += i >= n || b_forest_cursor_item(cursor)->key != arr[i++];
+    wrong += i != n;
+    time[1] = wall_time_ms();
+    i = n;
+    for (bool ok = b_forest_cursor_last(cursor); ok;
+         ok = b_forest_cursor_prev(cursor))
+        wrong += i <= 0 || b_forest_cursor_item(cursor)->key != arr[--i];
+    wrong += i != 0;
+    time[2] = wall_time_ms();
+    // 每页从上一页最后一个key加一处重新定位, 模拟无状态的分页导出
+    i = 0;
+    int next_key = INT_MIN + 1;
+    while (lr_tree_cursor_seek(lr_tree, cursor, next_key)) {
+        for (int k = 0; k < page; k++) {
+            next_key = b_forest_cursor_item(cursor)->key;
+            wrong += i >= n || next_key != arr[i++];
+            if (!b_forest_cursor_next(cursor))
+                break;
+        }
+        if (next_key == INT_MAX - 1)
+            break;
+        next_key++;
+    }
+    wrong += i != n;
+    time[3] = wall_time_ms();
+    printf("游标遍历 %d 个元素: 正序 %.0lf ms, 逆序 %.0lf ms, 每页 %d 个分页 "
+           "%.0lf ms, 错误 %d\n",
+           n, time[1] - time[0], time[2] - time[1], page, time[3] - time[2],
+           wrong);
+    b_forest_cursor_free(cursor);
+    lr_tree_free(lr_tree);
+    free(arr);
+}
+
+// 在有序数组sorted[0, n)中二分查找第一个不小于key的下标
+static int lower_index(const int *sorted, int n, int key) {
+    int l = 0, r = n;
+    while (l < r) {
+        int m = l + (r - l) / 2;
+        if (sorted[m] < key)
+            l = m + 1;
+        else
+            r = m;
+    }
+    return l;
+}
+
+static void bench_bound(int leaf_num, int b_tree_num) {
+    int n = 1e6;
+    int *arr = generate_sorted_arr(n);
+    LR_Tree_Root *lr_tree = lr_tree_create_from_keys(
+        arr, n, leaf_num, b_tree_num, INT_MIN + 1, INT_MAX - 1,
+        LR_ROUTE_BISECT);
+    // 只插入一半的key, 并删掉前后各一成, 让查询常常落到空的或没有答案的B树上
+    int m = 0;
+    for (int i = 0; i < n; i += 2)
+        arr[m++] = arr[i];
+    lr_tree_bulk_load(lr_tree, arr, NULL, m);
+    int lo = m / 10, hi = m - m / 10;
+    for (int i = 0; i < lo; i++)
+        lr_tree_erase(lr_tree, arr[i]);
+    for (int i = hi; i < m; i++)
+        lr_tree_erase(lr_tree, arr[i]);
+    int wrong = lr_tree_min(lr_tree)->key != arr[lo] ||
+                lr_tree_max(lr_tree)->key != arr[hi - 1];
+    int *query = (int *)malloc(sizeof(int) * n);
+    for (int i = 0; i < n; i++)
+        query[i] = arr[rand() % m] + rand() % 3 - 1;
+    double time[3];
+    time[0] = wall_time_ms();
+    for (int i = 0; i < n; i++) {
+        KV_Node *node = lr_tree_ceiling(lr_tree, query[i]);
+        int j = lower_index(arr + lo, hi - lo, query[i]) + lo;
+        wrong += j < hi ? !node || node->key != arr[j] : node != NULL;
+    }
+    time[1] = wall_time_ms();
+    for (int i = 0; i < n; i++) {
+        KV_Node *node = lr_tree_floor(lr_tree, query[i]);
+        int j = lower_index(arr + lo, hi - lo, query[i] + 1) + lo - 1;
+        wrong += j >= lo ? !node || node->key != arr[j] : node != NULL;
+    }
+    time[2] = wall_time_ms();
+    printf("%d 次查询(含比对): ceiling %.0lf ms, floor %.0lf ms, 错误 %d\n", n,
+           time[1] - time[0], time[2] - time[1], wrong);
+    free(query);
+    lr_tree_free(lr_tree);
+    free(arr);
+}
+
+static void bench_rank(int leaf_num, int b_tree_num) {
+    int n = 1e6;
+    int *arr = generate_sorted_arr(n);
+    // 打乱插入顺序, 让节点分裂与合并都走到
+    int *order = (int *)malloc(sizeof(int) * n);
+    for (int i = 0; i < n; i++)
+        order[i] = arr[i];
+    for (int i = n - 1; i > 0; i--) {
+        int j = rand() % (i + 1), t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    LR_Tree_Root *lr_tree[2];
+    double time[4];
+    for (int r = 0; r < 2; r++) {
+        lr_tree[r] = lr_tree_create_from_keys(arr, n, leaf_num, b_tree_num,
+                                              INT_MIN + 1, INT_MAX - 1,
+                                              LR_ROUTE_BISECT);
+        lr_tree_set_ranked(lr_tree[r], r == 1);
+        double start = wall_time_ms();
+        for (int i = 0; i < n; i++)
+            lr_tree_insert(lr_tree[r], order[i], "");
+        time[r] = wall_time_ms() - start;
+        // 删掉key为奇数的元素
+        start = wall_time_ms();
+        for (int i = 0; i < n; i++)
+            if (order[i] & 1)
+                lr_tree_erase(lr_tree[r], order[i]);
+        time[2 + r] = wall_time_ms() - start;
+    }
+    int m = 0;
+    for (int i = 0; i < n; i++)
+        if (!(arr[i] & 1))
+            arr[m++] = arr[i];
+    int wrong = lr_tree_select(lr_tree[1], m) != NULL;
+    double query[2];
+    query[0] = wall_time_ms();
+    for (int i = 0; i < n; i++) {
+        int key = arr[rand() % m] + rand() % 3 - 1;
+        wrong += lr_tree_rank(lr_tree[1], key) != (size_t)lower_index(arr, m, key);
+    }
+    query[1] = wall_time_ms();
+    for (int i = 0; i < n; i++) {
+        int j = rand() % m;
+        KV_Node *node = lr_tree_select(lr_tree[1], j);
+        wrong += !node || node->key != arr[j];
+    }
+    double end = wall_time_ms();
+    printf("插入 %d 个key: 普通 %.0lf ms, 排名模式 %.0lf ms; 删除一半: 普通 %.0lf "
+           "ms, 排名模式 %.0lf ms\n",
+           n, time[0], time[1], time[2], time[3]);
+    printf("%d 次查询(含比对): rank %.0lf ms, select %.0lf ms, 错误 %d\n", n,
+           query[1] - query[0], end - query[1], wrong);
+    lr_tree_free(lr_tree[0]);
+    lr_tree_free(lr_tree[1]);
+    free(order);
+    free(arr);
+}
+
+static void bench_estimate(int leaf_num, int b_tree_num, int width) {
+    int n = 1e6, q = 1e5;
+    int *arr = generate_sorted_arr(n);
+    LR_Tree_Root *lr_tree = lr_tree_create_from_keys(
+        arr, n, leaf_num, b_tree_num, INT_MIN + 1, INT_MAX - 1,
+        LR_ROUTE_BISECT);
+    lr_tree_bulk_load(lr_tree, arr, NULL, n);
+    // 区间两端取现有key附近的任意值, 跨越约width个元素
+    int *lo = (int *)malloc(sizeof(int) * q), *hi = (int *)malloc(sizeof(int) * q);
+    for (int r = 0; r < q; r++) {
+        int i = rand() % n, j = i + rand() % width;
+        lo[r] = arr[i] + rand() % 3 - 1;
+        hi[r] = arr[j < n ? j : n - 1] + rand() % 3 - 1;
+    }
+    double *estimate = (double *)malloc(sizeof(double) * q);
+    double *error = (double *)malloc(sizeof(double) * q);
+    double time[3];
+    time[0] = wall_time_ms();
+    for (int r = 0; r < q; r++)
+        estimate[r] = lr_tree_estimate_count(lr_tree, lo[r], hi[r], &error[r]);
+    time[1] = wall_time_ms();
+    for (int r = 0; r < q; r++) {
+        long long state[3] = {0, 0, 0};
+        lr_tree_range(lr_tree, lo[r], hi[r], count_range, state);
+    }
+    time[2] = wall_time_ms();
+    double abs_error = 0, bound = 0;
+    int outside = 0;
+    for (int r = 0; r < q; r++) {
+        int exact = lo[r] > hi[r] ? 0
+                                  : lower_index(arr, n, hi[r] + 1) -
+                                        lower_index(arr, n, lo[r]);
+        abs_error += fabs(estimate[r] - exact);
+        bound += error[r];
+        outside += fabs(estimate[r] - exact) > error[r] + 1e-6;
+    }
+    printf("估计 %d 个区间(约 %d 个元素): 单次 %.0lf ns, 平均绝对误差 %.1lf, "
+           "平均误差界 %.1lf, 越界 %d; 扫描计数单次 %.0lf ns\n",
+           q, width, (time[1] - time[0]) * 1e6 / q, abs_error / q, bound / q,
+           outside, (time[2] - time[1]) * 1e6 / q);
+    free(estimate);
+    free(error);
+    free(lo);
+    free(hi);
+    lr_tree_free(lr_tree);
+    free(arr);
+}
 
 int main(int argc, char *argv[]) {
     // -------------------参数设定---------------------
     srand(time(NULL));             // 初始化随机数种子
+    if (argc > 1 && strcmp(argv[1], "route") == 0) {
+        bench_route();
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "dist") == 0) {
+        bench_dist(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "build") == 0) {
+        bench_build(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "workload") == 0) {
+        bench_workload(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "hint") == 0) {
+        bench_hint(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 4 && strcmp(argv[1], "bulk") == 0) {
+        bench_bulk(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "merge") == 0) {
+        bench_merge(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "fanout") == 0) {
+        bench_fanout(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "update") == 0) {
+        bench_update(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "btree") == 0) {
+        bench_b_tree(atoi(argv[2]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "pod") == 0) {
+        bench_pod(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "rmw") == 0) {
+        bench_rmw(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 4 && strcmp(argv[1], "range") == 0) {
+        bench_range(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+        return 0;
+    }
+    if (argc > 4 && strcmp(argv[1], "cursor") == 0) {
+        bench_cursor(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "bound") == 0) {
+        bench_bound(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "rank") == 0) {
+        bench_rank(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
+    if (argc > 4 && strcmp(argv[1], "estimate") == 0) {
+        bench_estimate(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "model") == 0) {
+        bench_model(atoi(argv[2]), atoi(argv[3]));
+        return 0;
+    }
     int left_range = INT_MIN + 1;  // key值左边界
     int right_range = INT_MAX - 1; // key值右边界
 
@@ -24,7 +905,8 @@ int main(int argc, char *argv[]) {
     // printf("平均值: %lf  标准差: %lf\n", mean, sigma);
     clock_t start, end; // 每段程序的开始和结束时间点
     LR_Tree_Root *lr_tree = lr_tree_create(mean, sigma, leaf_num_1, leaf_num_2,
-                                           left_range, right_range);
+                                           left_range, right_range,
+                                           LR_ROUTE_BISECT, n_insert);
     start = clock();
     for (int i = 0; i < n_insert; i++) {
         char *s;
@@ -67,7 +949,8 @@ int main(int argc, char *argv[]) {
         // printf("平均值: %lf  标准差: %lf\n", mean, sigma);
         clock_t start, end; // 每段程序的开始和结束时间点
         LR_Tree_Root *lr_tree = lr_tree_create(
-            mean, sigma, leaf_num_1, leaf_num_2, left_range, right_range);
+            mean, sigma, leaf_num_1, leaf_num_2, left_range, right_range,
+            LR_ROUTE_BISECT, n_insert);
         start = clock();
         for (int i = 0; i < n_insert; i++) {
             char *s;
@@ -133,7 +1016,8 @@ int main(int argc, char *argv[]) {
     // -------------------树的构造--------------------
     struct B_Tree *b_tree = b_tree_create();
     LR_Tree_Root *lr_tree = lr_tree_create(mean, sigma, leaf_num_1, leaf_num_2,
-                                           left_range, right_range);
+                                           left_range, right_range,
+                                           LR_ROUTE_BISECT, n_insert);
     Fool_Tree_Root *fool_tree =
         fool_tree_create(left_range, right_range, leaf_num_1 * leaf_num_2);
     Hash_Tree_Root *hash_tree =
@@ -301,9 +1185,10 @@ int main(int argc, char *argv[]) {
     statistic_feature(arr, n, &avg, &sigma);
     //printf("平均值: %lf  标准差: %lf", avg, sigma);
     free(arr);
-    lr_tree_create(avg, sigma, 100, 100, INT_MIN + 1, INT_MAX - 1);
+    lr_tree_create(avg, sigma, 100, 100, INT_MIN + 1, INT_MAX - 1,
+    LR_ROUTE_BISECT, n);
     LR_Tree_Root* lr_tree = lr_tree_create(avg, sigma, 100, 100, INT_MIN + 1,
-    INT_MAX - 1); LARGE_INTEGER start, end, frequency;
+    INT_MAX - 1, LR_ROUTE_BISECT, n); LARGE_INTEGER start, end, frequency;
     // 获取计数器的频率
     QueryPerformanceFrequency(&frequency);
     // 获取开始时间
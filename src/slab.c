@@ -0,0 +1,148 @@
+#include "../inc/slab.h"
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// 向系统申请一段按SLAB_ARENA_SIZE对齐的arena, 并尽量以透明大页提供
+static Slab_Arena *slab_arena_map(void) {
+    size_t map_size = SLAB_ARENA_SIZE * 2; // 多申请一个arena的空间用于对齐
+#ifdef _WIN32
+    // 先只保留地址空间, 对齐之后再提交其中的一个arena, 多保留的部分不占物理内存
+    char *map = (char *)VirtualAlloc(NULL, map_size, MEM_RESERVE,
+                                     PAGE_NOACCESS);
+    if (map == NULL)
+        return NULL;
+#else
+    char *map = (char *)mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == (char *)MAP_FAILED)
+        return NULL;
+#endif
+    uintptr_t addr = ((uintptr_t)map + SLAB_ARENA_SIZE - 1) &
+                     ~(uintptr_t)(SLAB_ARENA_SIZE - 1);
+#ifdef _WIN32
+    if (VirtualAlloc((void *)addr, SLAB_ARENA_SIZE, MEM_COMMIT,
+                     PAGE_READWRITE) == NULL) {
+        VirtualFree(map, 0, MEM_RELEASE);
+        return NULL;
+    }
+#endif
+    Slab_Arena *arena = (Slab_Arena *)addr;
+#ifndef _WIN32
+    // 归还对齐之外的首尾部分, arena只占一个大页
+    size_t head = addr - (uintptr_t)map;
+    if (head > 0)
+        munmap(map, head);
+    if (map_size - head > SLAB_ARENA_SIZE)
+        munmap((char *)addr + SLAB_ARENA_SIZE,
+               map_size - head - SLAB_ARENA_SIZE);
+    map = (char *)addr;
+    map_size = SLAB_ARENA_SIZE;
+#ifdef MADV_HUGEPAGE
+    madvise(map, map_size, MADV_HUGEPAGE);
+#endif
+#endif
+    arena->map = map;
+    arena->map_size = map_size;
+    return arena;
+}
+
+static void slab_arena_unmap(Slab_Arena *arena) {
+#ifdef _WIN32
+    VirtualFree(arena->map, 0, MEM_RELEASE);
+#else
+    munmap(arena->map, arena->map_size);
+#endif
+}
+
+Slab *slab_create(void) {
+    Slab *slab = (Slab *)malloc(sizeof(Slab));
+    memset(slab, 0, sizeof(Slab));
+    return slab;
+}
+
+// 找到一个块已全部归还的尺寸类, 归还其全部arena并清空, 返回其下标, 没有时返回-1;
+// 只在尺寸类已满时调用, 反复清空又写入的尺寸类因此不会反复申请和归还arena
+static int slab_class_reclaim(Slab *slab) {
+    int c = 0;
+    while (c < slab->class_num && slab->cls[c].live)
+        c++;
+    if (c == slab->class_num)
+        return -1;
+    Slab_Arena **link = &slab->arena;
+    while (*link) {
+        Slab_Arena *arena = *link;
+        if (arena->cls == c) {
+            *link = arena->next;
+            slab_arena_unmap(arena);
+            slab->arena_num--;
+        } else {
+            link = &arena->next;
+        }
+    }
+    memset(&slab->cls[c], 0, sizeof(Slab_Class));
+    return c;
+}
+
+void *slab_alloc(void *slab_ptr, size_t size) {
+    Slab *slab = (Slab *)slab_ptr;
+    size = (size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+    if (size > SLAB_CHUNK_MAX)
+        return NULL;
+    int c = 0;
+    while (c < slab->class_num && slab->cls[c].size != size)
+        c++;
+    if (c == slab->class_num) {
+        if (c == SLAB_CLASS_MAX)
+            c = slab_class_reclaim(slab);
+        else
+            slab->class_num++;
+        if (c < 0)
+            return NULL;
+        slab->cls[c].size = size;
+    }
+    Slab_Class *cls = &slab->cls[c];
+    if (cls->free_list) {
+        void *ptr = cls->free_list;
+        cls->free_list = *(void **)ptr;
+        cls->live++;
+        return ptr;
+    }
+    if (cls->bump == NULL || cls->bump + size > cls->end) {
+        Slab_Arena *arena = slab_arena_map();
+        if (arena == NULL)
+            return NULL;
+        arena->cls = c;
+        arena->next = slab->arena;
+        slab->arena = arena;
+        slab->arena_num++;
+        // 头部之后按缓存行对齐切分
+        cls->bump = (char *)arena + ((sizeof(Slab_Arena) + CACHE_LINE - 1) &
+                                     ~(size_t)(CACHE_LINE - 1));
+        cls->end = (char *)arena + SLAB_ARENA_SIZE;
+    }
+    void *ptr = cls->bump;
+    cls->bump += size;
+    cls->live++;
+    return ptr;
+}
+
+void slab_free(void *slab_ptr, void *ptr) {
+    Slab *slab = (Slab *)slab_ptr;
+    Slab_Arena *arena = (Slab_Arena *)((uintptr_t)ptr &
+                                       ~(uintptr_t)(SLAB_ARENA_SIZE - 1));
+    Slab_Class *cls = &slab->cls[arena->cls];
+    *(void **)ptr = cls->free_list;
+    cls->free_list = ptr;
+    cls->live--;
+}
+
+void slab_destroy(Slab *slab) {
+    Slab_Arena *arena = slab->arena;
+    while (arena) {
+        Slab_Arena *next = arena->next;
+        slab_arena_unmap(arena);
+        arena = next;
+    }
+    free(slab);
+}
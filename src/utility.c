@@ -1,12 +1,16 @@
 #include "../inc/utility.h"
+#include "../inc/distribution.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 int kv_node_compare(const void *a, const void *b, void *udata) {
     const struct KV_Node *kv_a = a;
     const struct KV_Node *kv_b = b;
     if (kv_a->key < kv_b->key)
-        return 1;
-    else if (kv_a->key > kv_b->key)
         return -1;
+    else if (kv_a->key > kv_b->key)
+        return 1;
     return 0;
 }
 
@@ -52,7 +56,18 @@ void quick_sort(int *arr, int l, int r) {
     quick_sort(arr, l, j), quick_sort(arr, j + 1, r);
 }
 
+// 适配generate_sorted_arr_by的回调形式
+static int gauss_rand_adaptor(const void *udata) {
+    (void)udata;
+    return gauss_rand_integer();
+}
+
 int *generate_sorted_arr(int n) {
+    return generate_sorted_arr_by(n, gauss_rand_adaptor, NULL);
+}
+
+int *generate_sorted_arr_by(int n, int (*rand_integer)(const void *udata),
+                            const void *udata) {
     int *arr = malloc(n * sizeof(int));
     int arr_len = 0; // 初始的已填充的数字数量
     int *h = malloc((n + 10) * sizeof(int)); // 初始化哈希表和链表结构
@@ -65,7 +80,7 @@ int *generate_sorted_arr(int n) {
         h[i] = -1;
     }
     while (arr_len < n) {
-        int x = gauss_rand_integer(); // 随机产生一个整数
+        int x = rand_integer(udata); // 随机产生一个整数
         int u = (x % mod + mod) % mod;
         bool flag = false;
         for (int i = h[u]; i != -1; i = ne[i]) {
@@ -100,12 +115,12 @@ void statistic_feature(int *arr, int n, double *avg, double *sigma) {
     *sigma = sqrt((square_sum - n * pow(*avg, 2)) / (n - 1));
 }
 
-void print_kv_node(const KV_Node *node) {
+void print_kv_node(const KV_Node *node, const char *value) {
     if (node == NULL) {
         printf("<-----要打印的节点不存在----->\n");
         return;
     }
-    printf("Key: %d   Value: %s\n", node->key, node->str);
+    printf("Key: %d   Value: %s\n", node->key, value);
 }
 
 double normal_distribution(double mean, double sigma, double x) {
@@ -122,54 +137,149 @@ double normal_cdf(double mean, double sigma, double x) {
 
 double normal_icdf(double mean, double sigma, double y) {
     assert(y >= 0.0 && y <= 1.0);
-    // 开始二分查找
-    double left = mean - 10.0 * sigma;  // 设置搜索的左边界
-    double right = mean + 10.0 * sigma; // 设置搜索的右边界
-    while (right - left > EPSILON) {
-        double mid = (left + right) / 2.0;
-        double cdf_val = normal_cdf(mean, sigma, mid);
-        if (cdf_val > y) {
-            right = mid;
-        } else {
-            left = mid;
-        }
+    // Acklam有理逼近标准正态分布的分位数, 相对误差小于1.15e-9,
+    // 代替原先在erf上的数十步二分, 单次调用仅需若干次乘除(尾部多一次log和sqrt)
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                               -2.759285104469687e+02, 1.383577518672690e+02,
+                               -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                               -1.556989798598866e+02, 6.680131188771972e+01,
+                               -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                               -2.400758277161838e+00, -2.549732539343734e+00,
+                               4.374664141464968e+00,  2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01,
+                               2.445134137142996e+00, 3.754408661907416e+00};
+    const double y_low = 0.02425;
+    double z;
+    if (y <= 0.0 || y >= 1.0) {
+        z = (y <= 0.0) ? -10.0 : 10.0;
+    } else if (y < y_low) {
+        double q = sqrt(-2.0 * log(y));
+        z = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q +
+             c[5]) /
+            ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+    } else if (y <= 1.0 - y_low) {
+        double q = y - 0.5, r = q * q;
+        z = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r +
+             a[5]) *
+            q /
+            (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r +
+             1.0);
+    } else {
+        double q = sqrt(-2.0 * log(1.0 - y));
+        z = -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q +
+              c[5]) /
+            ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
     }
-    return (right + left) / 2.0;
+    // 与原先的二分一样, 结果限制在均值的10倍标准差之内
+    z = fmin(fmax(z, -10.0), 10.0);
+    return mean + sigma * z;
 }
 
 void linear_fitting(double mean, double sigma, int left, int right, double *k,
                     double *b, int base) {
-    // 取出一定的点数用于拟合CDF
-    int point_num = right - left;
-    point_num = (point_num > 500) ? 500 : point_num; // 取最多500点拟合
-    double *x_val = (double *)malloc(point_num * sizeof(double));
-    double *y_val = (double *)malloc(point_num * sizeof(double));
-    double x = (double)left;
-    double step = (double)(right - left) / (double)point_num;
-    double sum_x = 0.0, sum_y = 0.0, sum_xy = 0.0, sum_xx = 0.0;
-    // 在取出CDF函数值的同时基于base进行归一化, 重映射到[0, base - 1]之间
-    double y0 = normal_cdf(mean, sigma, (double)left);
-    double y1 = normal_cdf(mean, sigma, (double)right);
-    // double y2 = 0.0;
-    double y3 = base - 1.0;
-    for (int i = 0; i < point_num; i++) {
-        x_val[i] = x;
-        y_val[i] = normal_cdf(mean, sigma, x);
-        y_val[i] = (y_val[i] - y0) * y3 / (y1 - y0);
-        x += step;
-        sum_x += x_val[i];
-        sum_y += y_val[i];
-        sum_xy += x_val[i] * y_val[i];
-        sum_xx += x_val[i] * x_val[i];
-    }
-    // printf("本次拟合的首尾坐标: [%lf, %lf] [%lf, %lf]\n", x_val[0], y_val[0],
-    // x_val[point_num - 1], y_val[point_num - 1]);
-    double denominator = point_num * sum_xx - sum_x * sum_x;
-    assert(denominator != 0.0);
-    *k = (point_num * sum_xy - sum_x * sum_y) / denominator;
-    *b = (sum_y - (*k) * sum_x) / point_num;
-    free(x_val);
-    free(y_val);
+    Distribution dist = dist_gaussian(mean, sigma);
+    dist_linear_fitting(&dist, left, right, k, b, base);
+}
+
+void sample_linear_fitting(const int *keys, int n, double *k, double *b,
+                           int base) {
+    // 对有序样本的(key, rank)点对进行最小二乘拟合, rank重映射到[0, base)之间
+    if (n <= 1) {
+        *k = 0.0;
+        *b = 0.0;
+        return;
+    }
+    double scale = (double)base / (double)n; // 每个rank对应的纵坐标增量
+    double mean_x = 0.0, mean_y = 0.0;
+    for (int i = 0; i < n; i++) {
+        mean_x += keys[i];
+        mean_y += i * scale;
+    }
+    mean_x /= n;
+    mean_y /= n;
+    // key值量级较大, 先中心化再求和以避免精度损失
+    double sum_xy = 0.0, sum_xx = 0.0;
+    for (int i = 0; i < n; i++) {
+        double dx = keys[i] - mean_x;
+        sum_xy += dx * (i * scale - mean_y);
+        sum_xx += dx * dx;
+    }
+    *k = (sum_xx > 0.0) ? sum_xy / sum_xx : 0.0;
+    *b = mean_y - (*k) * mean_x;
+}
+
+void weighted_linear_fitting(const int *keys, const double *cum, int n,
+                             double *k, double *b, int base) {
+    double total = cum[n] - cum[0];
+    if (n <= 1 || total <= 0.0) {
+        *k = 0.0;
+        *b = 0.0;
+        return;
+    }
+    double scale = (double)base / total; // 单位权重对应的纵坐标增量
+    double mean_x = 0.0, mean_y = 0.0;
+    for (int i = 0; i < n; i++) {
+        double w = cum[i + 1] - cum[i];
+        mean_x += w * keys[i];
+        mean_y += w * (cum[i] - cum[0]) * scale;
+    }
+    mean_x /= total;
+    mean_y /= total;
+    // 同sample_linear_fitting, 先中心化再求和, 且每个点按其权重计入
+    double sum_xy = 0.0, sum_xx = 0.0;
+    for (int i = 0; i < n; i++) {
+        double w = cum[i + 1] - cum[i];
+        double dx = keys[i] - mean_x;
+        sum_xy += w * dx * ((cum[i] - cum[0]) * scale - mean_y);
+        sum_xx += w * dx * dx;
+    }
+    *k = (sum_xx > 0.0) ? sum_xy / sum_xx : 0.0;
+    *b = mean_y - (*k) * mean_x;
+}
+
+void *aligned_malloc(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, CACHE_LINE);
+#else
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, CACHE_LINE, size) != 0)
+        return NULL;
+    return ptr;
+#endif
+}
+
+void aligned_free(void *ptr) {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    int n = (int)info.dwNumberOfProcessors;
+#else
+    int n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return n > 0 ? n : 1;
+}
+
+double wall_time_ms(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart * 1e3 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+#endif
 }
 
 char **generate_str(int n, int *arr) {
@@ -0,0 +1,179 @@
+#include "../inc/value_log.h"
+
+#define VALUE_LOG_OFFSET_MASK (((uint32_t)1 << VALUE_LOG_OFFSET_BITS) - 1)
+
+// 长度为len的字符串占用的记录字节数: 4字节长度、字符串及'\0', 按VALUE_LOG_ALIGN取整
+static size_t value_log_record_size(size_t len) {
+    return (sizeof(uint32_t) + len + 1 + VALUE_LOG_ALIGN - 1) &
+           ~(size_t)(VALUE_LOG_ALIGN - 1);
+}
+
+// 句柄h对应记录的起始地址
+static char *value_log_record(const Value_Log *log, uint32_t h) {
+    return log->seg[h >> VALUE_LOG_OFFSET_BITS].data +
+           (size_t)(h & VALUE_LOG_OFFSET_MASK) * VALUE_LOG_ALIGN;
+}
+
+// 分配一个size字节的新段, 优先重用已归还的段号, 失败时返回UINT32_MAX
+static uint32_t value_log_open(Value_Log *log, size_t size) {
+    uint32_t id = 0;
+    while (id < log->seg_num && log->seg[id].data)
+        id++;
+    if (id == log->seg_num) {
+        if (id == VALUE_LOG_SEGMENT_MAX)
+            return UINT32_MAX;
+        if (id == log->seg_cap) {
+            uint32_t cap = log->seg_cap ? log->seg_cap * 2 : 16;
+            Value_Log_Segment *seg = (Value_Log_Segment *)realloc(
+                log->seg, cap * sizeof(Value_Log_Segment));
+            if (seg == NULL)
+                return UINT32_MAX;
+            log->seg = seg;
+            log->seg_cap = cap;
+        }
+    }
+    char *data = (char *)malloc(size);
+    if (data == NULL)
+        return UINT32_MAX;
+    if (id == log->seg_num)
+        log->seg_num++;
+    Value_Log_Segment *seg = &log->seg[id];
+    seg->data = data;
+    seg->size = (uint32_t)size;
+    seg->used = VALUE_LOG_ALIGN; // 段首留空, 句柄不会为VALUE_LOG_NULL
+    seg->dead = 0;
+    seg->victim = false;
+    log->bytes += size;
+    return id;
+}
+
+// 归还段号为id的段, 其中剩余的记录不再计入
+static void value_log_close(Value_Log *log, uint32_t id) {
+    Value_Log_Segment *seg = &log->seg[id];
+    log->dead -= seg->dead;
+    log->live -= seg->used - VALUE_LOG_ALIGN - seg->dead;
+    log->bytes -= seg->size;
+    free(seg->data);
+    seg->data = NULL;
+    seg->victim = false;
+    if (log->active == id)
+        log->active = UINT32_MAX;
+}
+
+// 段中的记录是否已全部失效
+static bool value_log_all_dead(const Value_Log_Segment *seg) {
+    return seg->dead == seg->used - VALUE_LOG_ALIGN;
+}
+
+Value_Log *value_log_create(void) {
+    Value_Log *log = (Value_Log *)malloc(sizeof(Value_Log));
+    memset(log, 0, sizeof(Value_Log));
+    log->active = UINT32_MAX;
+    return log;
+}
+
+void value_log_destroy(Value_Log *log) {
+    for (uint32_t id = 0; id < log->seg_num; id++)
+        free(log->seg[id].data);
+    free(log->seg);
+    free(log);
+}
+
+uint32_t value_log_append(Value_Log *log, const char *s) {
+    size_t len = strlen(s);
+    size_t rec = value_log_record_size(len);
+    uint32_t id;
+    if (rec > VALUE_LOG_SEGMENT_SIZE - VALUE_LOG_ALIGN) {
+        // 超大记录独占一段, 不打断当前段的追加
+        if (rec > UINT32_MAX - VALUE_LOG_ALIGN)
+            return VALUE_LOG_NULL;
+        id = value_log_open(log, VALUE_LOG_ALIGN + rec);
+    } else {
+        uint32_t prev = log->active;
+        if (prev == UINT32_MAX ||
+            log->seg[prev].used + rec > log->seg[prev].size) {
+            log->active = value_log_open(log, VALUE_LOG_SEGMENT_SIZE);
+            // 写满的旧段若已全部失效, 不必等到整理
+            if (prev != UINT32_MAX && value_log_all_dead(&log->seg[prev]))
+                value_log_close(log, prev);
+        }
+        id = log->active;
+    }
+    if (id == UINT32_MAX)
+        return VALUE_LOG_NULL;
+    Value_Log_Segment *seg = &log->seg[id];
+    char *p = seg->data + seg->used;
+    *(uint32_t *)p = (uint32_t)len;
+    memcpy(p + sizeof(uint32_t), s, len + 1);
+    uint32_t h = (id << VALUE_LOG_OFFSET_BITS) | (seg->used / VALUE_LOG_ALIGN);
+    seg->used += (uint32_t)rec;
+    log->live += rec;
+    return h;
+}
+
+const char *value_log_get(const Value_Log *log, uint32_t h) {
+    if (h == VALUE_LOG_NULL)
+        return NULL;
+    return value_log_record(log, h) + sizeof(uint32_t);
+}
+
+void value_log_release(Value_Log *log, uint32_t h) {
+    if (h == VALUE_LOG_NULL)
+        return;
+    uint32_t id = h >> VALUE_LOG_OFFSET_BITS;
+    Value_Log_Segment *seg = &log->seg[id];
+    size_t rec = value_log_record_size(*(uint32_t *)value_log_record(log, h));
+    seg->dead += (uint32_t)rec;
+    log->live -= rec;
+    log->dead += rec;
+    if (id != log->active && !seg->victim && value_log_all_dead(seg))
+        value_log_close(log, id);
+}
+
+bool value_log_need_compact(const Value_Log *log) {
+    return log->dead >= VALUE_LOG_COMPACT_MIN && log->dead > log->live;
+}
+
+int value_log_compact_begin(Value_Log *log) {
+    int victim_num = 0;
+    for (uint32_t id = 0; id < log->seg_num; id++) {
+        Value_Log_Segment *seg = &log->seg[id];
+        if (seg->data && seg->dead * 2 >= seg->used - VALUE_LOG_ALIGN) {
+            seg->victim = true;
+            victim_num++;
+            if (log->active == id)
+                log->active = UINT32_MAX;
+        }
+    }
+    return victim_num;
+}
+
+uint32_t value_log_relocate(Value_Log *log, uint32_t h) {
+    if (h == VALUE_LOG_NULL || !log->seg[h >> VALUE_LOG_OFFSET_BITS].victim)
+        return h;
+    // 复制的是旧段中的字符串, 追加可能扩容seg数组, 但不会移动段内存
+    const char *s = value_log_get(log, h);
+    uint32_t moved = value_log_append(log, s);
+    Value_Log_Segment *seg = &log->seg[h >> VALUE_LOG_OFFSET_BITS];
+    if (moved == VALUE_LOG_NULL) {
+        // 内存不足时保留旧段, 已搬走的记录在其中按失效计
+        seg->victim = false;
+        return h;
+    }
+    size_t rec = value_log_record_size(*(uint32_t *)value_log_record(log, h));
+    seg->dead += (uint32_t)rec;
+    log->live -= rec;
+    log->dead += rec;
+    return moved;
+}
+
+void value_log_compact_end(Value_Log *log) {
+    for (uint32_t id = 0; id < log->seg_num; id++)
+        if (log->seg[id].data && log->seg[id].victim)
+            value_log_close(log, id);
+}
+
+size_t value_log_memory(const Value_Log *log) {
+    return sizeof(Value_Log) + log->seg_cap * sizeof(Value_Log_Segment) +
+           log->bytes;
+}